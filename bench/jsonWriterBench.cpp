@@ -0,0 +1,100 @@
+// Compares JsonWriter with nlohmann::json::dump on an ExecRet payload the size of a large
+// SQF array result. Build with -DBUILD_BENCHMARKS=ON, it needs neither Intercept nor Arma.
+//   jsonWriterBench [units] [runs]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "jsonWriter.hpp"
+
+using nlohmann::json;
+
+static const char* const names[] = {
+    "Alpha 1-1:1",
+    "Bravo 2-3:4 (\"Viper\")",
+    "Ein Soldat mit Umlauten \xC3\xA4\xC3\xB6\xC3\xBC",
+    "C:\\Arma3\\missions\\test.Altis",
+    "tab\tand\nnewline",
+};
+
+static json execRet(json res) {
+    return {
+        { "type", "ExecRet" },
+        { "res", std::move(res) },
+        { "id", 42 },
+        { "frame", 123456 },
+    };
+}
+
+// Roughly what a script returning info about every unit produces
+static json makeValues(size_t units) {
+    json res = json::array();
+    for (size_t i = 0; i < units; ++i) {
+        res.push_back({
+            names[i % (sizeof(names) / sizeof(*names))],
+            "B_Soldier_F",
+            { 1000.0 + i * 0.25f, 2000.0 + i * 0.5f, 1.5 },
+            static_cast<double>(i % 100) / 100.0,
+            i % 3 == 0,
+            static_cast<int64_t>(i),
+        });
+    }
+    return execRet(std::move(res));
+}
+
+// The same as one string of SQF array text, what str on the result gives
+static json makeText(size_t units) {
+    std::string text = "[";
+    for (size_t i = 0; i < units; ++i) {
+        if (i)
+            text += ',';
+        text += "[\"";
+        text += names[i % (sizeof(names) / sizeof(*names))];
+        text += "\",\"B_Soldier_F\",[" + std::to_string(1000 + i / 4) + ".25," + std::to_string(2000 + i / 2) + ".5,1.5],0.75,true," + std::to_string(i) + "]";
+    }
+    text += ']';
+    return execRet(std::move(text));
+}
+
+template<class Function>
+static double bestOf(size_t runs, Function&& run) {
+    double best = 1e300;
+    for (size_t i = 0; i < runs; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+static bool compare(const char* name, const json& document, size_t runs) {
+    std::string dumped;
+    auto dumpTime = bestOf(runs, [&]() {
+        dumped = document.dump();
+    });
+
+    std::string written;
+    auto writerTime = bestOf(runs, [&]() {
+        written.clear();
+        JsonWriter writer(written);
+        writer.value(document);
+    });
+
+    // Not byte identical, to_chars writes 1.0 as 1. Both have to parse to the same values though
+    bool sameValues = json::parse(dumped) == json::parse(written);
+    std::printf("%s: %zu bytes\n", name, dumped.size());
+    std::printf("  dump       %8.2f ms\n", dumpTime);
+    std::printf("  JsonWriter %8.2f ms\n", writerTime);
+    std::printf("  same values: %s, same bytes: %s\n", sameValues ? "yes" : "NO", dumped == written ? "yes" : "no");
+    return sameValues;
+}
+
+int main(int argc, char** argv) {
+    const size_t units = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+    const size_t runs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20;
+
+    bool ok = compare("values", makeValues(units), runs);
+    ok = compare("text", makeText(units), runs) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+#include "codeCache.hpp"
+#include "config.hpp"
+
+static LruCache<game_value> compiledCode;
+static LruCache<game_value> missionFunctions;
+
+// The size of the compiled code isn't known, it is estimated from the script length
+static size_t estimatedCost(std::string_view text) {
+    return 2 * text.size() + 128;
+}
+
+code compileCached(std::string_view script) {
+    if (!config.codeCacheBytes)
+        return intercept::sqf::compile(script);
+
+    if (auto cached = compiledCode.find(script))
+        return *cached;
+
+    auto compiled = intercept::sqf::compile(script);
+    compiledCode.insert(script, compiled, estimatedCost(script), config.codeCacheBytes);
+    return compiled;
+}
+
+game_value missionFunctionCached(std::string_view name) {
+    if (!config.codeCacheBytes)
+        return intercept::sqf::get_variable(intercept::sqf::mission_namespace(), name);
+
+    // Not validated against missionNamespace, that lookup is what the cache saves
+    if (auto cached = missionFunctions.find(name))
+        return *cached;
+
+    auto func = intercept::sqf::get_variable(intercept::sqf::mission_namespace(), name);
+    // The code itself is referenced from missionNamespace anyway, an entry costs little more than its name
+    if (!func.is_nil())
+        missionFunctions.insert(name, func, estimatedCost(name), config.codeCacheBytes);
+    return func;
+}
+
+void clearCodeCaches() {
+    compiledCode.clear();
+    missionFunctions.clear();
+}
+
+CodeCacheStats compiledCodeStats() {
+    return compiledCode.statistics();
+}
+
+CodeCacheStats missionFunctionStats() {
+    return missionFunctions.statistics();
+}
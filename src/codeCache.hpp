@@ -0,0 +1,100 @@
+#pragma once
+#include <intercept.hpp>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Least recently used cache keyed by the hash of a string. The full key is kept and compared,
+// so a hash collision is just a miss. Not thread safe, the caches below are game thread only.
+template<class Value>
+class LruCache {
+public:
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+    // Returns nullptr on a miss. A hit becomes the most recently used entry
+    Value* find(std::string_view key) {
+        auto found = index.find(std::hash<std::string_view>()(key));
+        if (found == index.end() || found->second->key != key) {
+            ++counters.misses;
+            return nullptr;
+        }
+        ++counters.hits;
+        entries.splice(entries.begin(), entries, found->second);
+        return &found->second->value;
+    }
+
+    // cost is what the entry counts against capacity. Least recently used entries are evicted to make room
+    void insert(std::string_view key, Value value, size_t cost, size_t capacity) {
+        auto hash = std::hash<std::string_view>()(key);
+        auto found = index.find(hash);
+        if (found != index.end())
+            erase(found->second);
+        if (cost > capacity)
+            return;
+
+        while (counters.bytes + cost > capacity)
+            erase(std::prev(entries.end()));
+
+        entries.push_front(entry{ std::string(key), hash, std::move(value), cost });
+        index.emplace(hash, entries.begin());
+        counters.bytes += cost;
+        ++counters.entries;
+    }
+
+    void clear() {
+        index.clear();
+        entries.clear();
+        counters.entries = 0;
+        counters.bytes = 0;
+    }
+
+    const stats& statistics() const {
+        return counters;
+    }
+
+private:
+    struct entry {
+        std::string key;
+        size_t hash;
+        Value value;
+        size_t cost;
+    };
+
+    void erase(typename std::list<entry>::iterator it) {
+        counters.bytes -= it->cost;
+        --counters.entries;
+        index.erase(it->hash);
+        entries.erase(it);
+    }
+
+    // Most recently used first
+    std::list<entry> entries;
+    std::unordered_map<size_t, typename std::list<entry>::iterator> index;
+    stats counters;
+};
+
+using CodeCacheStats = LruCache<game_value>::stats;
+
+// Game thread only. Compiles the script, or returns the code compiled for the same text before.
+// The watch panel sends the same scripts every few seconds, they are compiled once
+code compileCached(std::string_view script);
+
+// Game thread only. Looks up a function by its variable name in missionNamespace.
+// Cached the same way, nil isn't cached so functions that are defined later are found.
+// A hit is kept until the mission ends or the entry is evicted, so a function that is
+// redefined mid-mission still runs its old code. CfgFunctions are compileFinal and can't change
+game_value missionFunctionCached(std::string_view name);
+
+// Drops everything that belongs to the mission, called when it ends
+void clearCodeCaches();
+
+CodeCacheStats compiledCodeStats();
+CodeCacheStats missionFunctionStats();
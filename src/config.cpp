@@ -0,0 +1,77 @@
+#include "config.hpp"
+#include "json.hpp"
+#include <fstream>
+#include <iostream>
+
+using json = nlohmann::json;
+
+Config config;
+
+// A setting of the wrong type keeps its default, a typo must not keep the server from starting
+template<class T>
+static void read(const json& settings, const char* name, T& value) {
+    try {
+        value = settings.value(name, value);
+    } catch (const json::exception& e) {
+        std::cerr << "config: " << name << ": " << e.what() << ", using the default\n";
+    }
+}
+
+template<class Rep, class Period>
+static void read(const json& settings, const char* name, std::chrono::duration<Rep, Period>& value) {
+    auto count = value.count();
+    read(settings, name, count);
+    value = std::chrono::duration<Rep, Period>(count);
+}
+
+void Config::load(const std::filesystem::path& file) {
+    std::ifstream input(file);
+    if (!input.is_open())
+        return; // No config, use defaults
+
+    auto settings = json::parse(input, nullptr, false);
+    if (!settings.is_object()) {
+        std::cerr << "config: " << file.string() << " is not a valid json object, using defaults\n";
+        return;
+    }
+
+    read(settings, "address", address);
+    read(settings, "port", port);
+    read(settings, "ioThreads", ioThreads);
+    read(settings, "ioAffinity", ioAffinity);
+    read(settings, "ioPriority", ioPriority);
+    read(settings, "maxInFlight", maxInFlight);
+    read(settings, "maxOutboundBytes", maxOutboundBytes);
+    read(settings, "maxOutboundMessages", maxOutboundMessages);
+    std::string policy;
+    read(settings, "outboundPolicy", policy);
+    if (policy == "dropOldest")
+        outboundPolicy = outbound_policy::drop_oldest;
+    else if (policy == "dropNewest")
+        outboundPolicy = outbound_policy::drop_newest;
+    else if (policy == "disconnect")
+        outboundPolicy = outbound_policy::disconnect;
+    else if (!policy.empty())
+        std::cerr << "config: unknown outboundPolicy " << policy << "\n";
+    read(settings, "slowClientTimeoutMs", slowClientTimeout);
+    read(settings, "resultMaxDepth", resultMaxDepth);
+    read(settings, "resultMaxElements", resultMaxElements);
+    read(settings, "streamThreshold", streamThreshold);
+    read(settings, "streamChunkValues", streamChunkValues);
+    streamChunkValues = (std::max)(streamChunkValues, size_t(1));
+    read(settings, "streamMaxUnsentChunks", streamMaxUnsentChunks);
+    streamMaxUnsentChunks = (std::max)(streamMaxUnsentChunks, size_t(1));
+    read(settings, "maxPreparedScripts", maxPreparedScripts);
+    read(settings, "maxSubscriptions", maxSubscriptions);
+    read(settings, "maxAsyncScripts", maxAsyncScripts);
+    read(settings, "maxPipelineSteps", maxPipelineSteps);
+    read(settings, "codeCacheBytes", codeCacheBytes);
+    read(settings, "frameBudgetUs", frameBudget);
+    read(settings, "schedulerQuantumUs", schedulerQuantum);
+    // Deficits have to grow, or the scheduler never gets to run anything
+    schedulerQuantum = (std::max)(schedulerQuantum, std::chrono::microseconds(1));
+    read(settings, "defaultWeight", defaultWeight);
+    read(settings, "weights", weights);
+    read(settings, "rateLimit", rateLimit);
+    read(settings, "rateBurst", rateBurst);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Settings from ArmaWebControl.json next to the plugin dll.
+// Every entry is optional, missing ones keep the defaults below.
+struct Config {
+    std::string address = "0.0.0.0";
+    unsigned short port = 8082;
+
+    // Threads serving HTTP and websocket traffic. 0 uses half the hardware threads
+    size_t ioThreads = 2;
+    // CPUs the IO threads may run on, empty means no restriction
+    std::vector<unsigned> ioAffinity;
+    // Scheduling priority of the IO threads so they don't take time from the game's simulation thread.
+    // "normal", "low" or "idle"
+    std::string ioPriority = "low";
+
+    size_t ioThreadCount() const {
+        if (ioThreads)
+            return ioThreads;
+        return (std::max)(std::thread::hardware_concurrency() / 2, 1u);
+    }
+
+    // Tasks per session that may be queued or running at once, reading pauses when it is reached
+    size_t maxInFlight = 256;
+
+    // Limits for data waiting to be sent to a client that doesn't keep up with reading
+    size_t maxOutboundBytes = 4 * 1024 * 1024;
+    size_t maxOutboundMessages = 1024;
+    enum class outbound_policy {
+        drop_oldest,
+        drop_newest,
+        disconnect
+    };
+    // What happens to messages over the limits. "dropOldest", "dropNewest" or "disconnect"
+    outbound_policy outboundPolicy = outbound_policy::drop_oldest;
+    // A client that stays over the limits that long is disconnected, whatever the policy
+    std::chrono::milliseconds slowClientTimeout{ 10000 };
+
+    // Limits for encoding script results as json, deeper nesting or more values are cut off
+    size_t resultMaxDepth = 32;
+    size_t resultMaxElements = 1000000;
+
+    // Results with more values than streamThreshold are captured over several frames, streamChunkValues
+    // per frame, and sent as numbered chunks. 0 disables streaming
+    size_t streamThreshold = 50000;
+    size_t streamChunkValues = 20000;
+    // Capturing pauses while that many chunks of a stream wait to be written to the client
+    size_t streamMaxUnsentChunks = 4;
+
+    // Scripts a session may keep prepared at once
+    size_t maxPreparedScripts = 1024;
+    // Subscriptions a session may have at once
+    size_t maxSubscriptions = 256;
+    // ExecAsync scripts a session may have running at once
+    size_t maxAsyncScripts = 64;
+    // Steps a single Pipeline may have, all of them run in one frame
+    size_t maxPipelineSteps = 64;
+
+    // Memory cap for the caches of compiled scripts and function lookups, 0 disables them
+    size_t codeCacheBytes = 16 * 1024 * 1024;
+
+    // Game thread time per frame for running tasks, tasks that don't fit are carried over to the next frame.
+    // 0 means no limit
+    std::chrono::microseconds frameBudget{ 3000 };
+
+    // Game thread time a session with weight 1 gets per scheduling round
+    std::chrono::microseconds schedulerQuantum{ 200 };
+    // Share of the frame budget a session gets relative to the others
+    double defaultWeight = 1;
+    // Per remote address weights, for example { "127.0.0.1": 4 }
+    std::map<std::string, double> weights;
+
+    // Token bucket per session. Tasks per second, 0 means unlimited, and how many can be run in a burst
+    double rateLimit = 0;
+    double rateBurst = 200;
+
+    double weightFor(const std::string& remoteAddress) const {
+        auto found = weights.find(remoteAddress);
+        return found != weights.end() ? found->second : defaultWeight;
+    }
+
+    void load(const std::filesystem::path& file);
+};
+
+extern Config config;
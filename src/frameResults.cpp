@@ -0,0 +1,72 @@
+#include "frameResults.hpp"
+#include "tasks.hpp"
+#include <unordered_map>
+
+static std::unordered_map<std::string, FrameResult> frameResults;
+static FrameResultStats stats;
+
+static void appendArgKey(std::string& key, const TaskArg& arg) {
+    key += static_cast<char>(arg.type);
+    switch (arg.type) {
+        case TaskArg::kind::number:
+            key.append(reinterpret_cast<const char*>(&arg.number), sizeof(arg.number));
+            break;
+        case TaskArg::kind::boolean:
+            key += arg.boolean ? '1' : '0';
+            break;
+        case TaskArg::kind::string:
+        case TaskArg::kind::code: {
+            // Length first, so the text can't be mistaken for the next argument
+            auto length = static_cast<uint32_t>(arg.text.size());
+            key.append(reinterpret_cast<const char*>(&length), sizeof(length));
+            key += arg.text;
+        } break;
+        case TaskArg::kind::array:
+            for (auto& it : arg.elements)
+                appendArgKey(key, it);
+            key += ']';
+            break;
+        default: break;
+    }
+}
+
+std::string frameResultKey(const TaskRequest& task) {
+    std::string key;
+    if (task.fnc.empty()) {
+        key += 's';
+        key += task.script;
+        return key;
+    }
+
+    key += 'f';
+    key += task.fnc;
+    key += '\0';
+    for (auto& it : task.args)
+        appendArgKey(key, it);
+    return key;
+}
+
+FrameResult* findFrameResult(const std::string& key) {
+    auto found = frameResults.find(key);
+    if (found == frameResults.end()) {
+        ++stats.misses;
+        return nullptr;
+    }
+    ++stats.hits;
+    return &found->second;
+}
+
+FrameResult& storeFrameResult(std::string key, game_value value) {
+    auto& result = frameResults[std::move(key)];
+    result.value = std::move(value);
+    result.tape.reset();
+    return result;
+}
+
+void clearFrameResults() {
+    frameResults.clear();
+}
+
+FrameResultStats frameResultStats() {
+    return stats;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <intercept.hpp>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include "valueTape.hpp"
+
+struct TaskRequest;
+
+// Results of tasks marked pure (side effect free), shared by all sessions during one frame.
+// Several dashboards asking for diag_fps in the same frame run it once.
+// Game thread only, cleared at the end of every frame.
+struct FrameResult {
+    game_value value;
+    // The captured answer, so other sessions don't even walk the value again. Unset for streamed results
+    std::optional<ValueTape> tape;
+};
+
+struct FrameResultStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+// What identifies a pure task: the script, or the function and its arguments
+std::string frameResultKey(const TaskRequest& task);
+
+// nullptr if nobody ran it this frame yet
+FrameResult* findFrameResult(const std::string& key);
+FrameResult& storeFrameResult(std::string key, game_value value);
+void clearFrameResults();
+
+FrameResultStats frameResultStats();
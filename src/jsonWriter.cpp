@@ -0,0 +1,229 @@
+#include "jsonWriter.hpp"
+#include <charconv>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define AWC_JSON_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AWC_JSON_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline unsigned firstSetBit(uint32_t mask) {
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+}
+#else
+static inline unsigned firstSetBit(uint32_t mask) {
+    return static_cast<unsigned>(__builtin_ctz(mask));
+}
+#endif
+
+static const char hexDigits[] = "0123456789abcdef";
+
+// Returns the length of the valid UTF-8 sequence at data, or 0 if it is invalid
+static size_t validUtf8Length(const unsigned char* data, size_t available) {
+    const unsigned char lead = data[0];
+    size_t length;
+    unsigned char min = 0x80, max = 0xBF; // allowed range of the second byte
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        if (lead == 0xE0) min = 0xA0; // overlong
+        if (lead == 0xED) max = 0x9F; // surrogates
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        if (lead == 0xF0) min = 0x90; // overlong
+        if (lead == 0xF4) max = 0x8F; // above U+10FFFF
+    } else {
+        return 0;
+    }
+    if (available < length || data[1] < min || data[1] > max)
+        return 0;
+    for (size_t i = 2; i < length; ++i) {
+        if ((data[i] & 0xC0) != 0x80)
+            return 0;
+    }
+    return length;
+}
+
+// Handles the byte at pos that the scan flagged, returns how many bytes were consumed
+static size_t appendSpecial(std::string& out, const unsigned char* data, size_t pos, size_t size) {
+    const unsigned char c = data[pos];
+    switch (c) {
+        case '"': out += "\\\""; return 1;
+        case '\\': out += "\\\\"; return 1;
+        case '\b': out += "\\b"; return 1;
+        case '\f': out += "\\f"; return 1;
+        case '\n': out += "\\n"; return 1;
+        case '\r': out += "\\r"; return 1;
+        case '\t': out += "\\t"; return 1;
+        default: break;
+    }
+    if (c < 0x20) {
+        const char escape[] = { '\\', 'u', '0', '0', hexDigits[c >> 4], hexDigits[c & 0xF] };
+        out.append(escape, sizeof(escape));
+        return 1;
+    }
+    // Non ASCII, copy it if it's valid UTF-8
+    auto length = validUtf8Length(data + pos, size - pos);
+    if (!length) {
+        out += "\xEF\xBF\xBD"; // U+FFFD
+        return 1;
+    }
+    out.append(reinterpret_cast<const char*>(data + pos), length);
+    return length;
+}
+
+// Bit mask of bytes that need attention, quote, backslash, control characters and
+// non ASCII. The signed compare catches both < 0x20 and >= 0x80.
+#ifdef AWC_JSON_AVX2
+static inline uint32_t specialMask32(const unsigned char* data) {
+    const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    const __m256i control = _mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), chunk);
+    const __m256i quote = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('"'));
+    const __m256i backslash = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\\'));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(control, _mm256_or_si256(quote, backslash))));
+}
+#endif
+#ifdef AWC_JSON_SSE2
+static inline uint32_t specialMask16(const unsigned char* data) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    const __m128i control = _mm_cmplt_epi8(chunk, _mm_set1_epi8(0x20));
+    const __m128i quote = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'));
+    const __m128i backslash = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(control, _mm_or_si128(quote, backslash))));
+}
+#endif
+
+static inline bool isSpecial(unsigned char c) {
+    return c < 0x20 || c >= 0x80 || c == '"' || c == '\\';
+}
+
+void appendJsonString(std::string& out, std::string_view str) {
+    auto data = reinterpret_cast<const unsigned char*>(str.data());
+    const size_t size = str.size();
+    out.reserve(out.size() + size + 2);
+    out += '"';
+
+    size_t pos = 0;
+    // Start of the bytes that are not copied yet
+    size_t pending = 0;
+    auto flush = [&](size_t end) {
+        out.append(str.data() + pending, end - pending);
+    };
+
+#ifdef AWC_JSON_AVX2
+    while (pos + 32 <= size) {
+        auto mask = specialMask32(data + pos);
+        if (!mask) {
+            pos += 32;
+            continue;
+        }
+        const size_t special = pos + firstSetBit(mask);
+        flush(special);
+        pos = special + appendSpecial(out, data, special, size);
+        pending = pos;
+    }
+#endif
+#ifdef AWC_JSON_SSE2
+    while (pos + 16 <= size) {
+        auto mask = specialMask16(data + pos);
+        if (!mask) {
+            pos += 16;
+            continue;
+        }
+        const size_t special = pos + firstSetBit(mask);
+        flush(special);
+        pos = special + appendSpecial(out, data, special, size);
+        pending = pos;
+    }
+#endif
+    while (pos < size) {
+        if (!isSpecial(data[pos])) {
+            ++pos;
+            continue;
+        }
+        flush(pos);
+        pos += appendSpecial(out, data, pos, size);
+        pending = pos;
+    }
+    flush(size);
+    out += '"';
+}
+
+void appendJsonNumber(std::string& out, double value) {
+    if (!std::isfinite(value)) {
+        out += "null";
+        return;
+    }
+    char buffer[32];
+    // Without a precision to_chars gives the shortest round trip representation
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+void appendJsonNumber(std::string& out, float value) {
+    if (!std::isfinite(value)) {
+        out += "null";
+        return;
+    }
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+void appendJsonNumber(std::string& out, int64_t value) {
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+void appendJsonNumber(std::string& out, uint64_t value) {
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+void JsonWriter::value(const nlohmann::json& document) {
+    switch (document.type()) {
+        case nlohmann::json::value_t::object:
+            startObject();
+            for (auto it = document.begin(); it != document.end(); ++it) {
+                key(it.key());
+                value(it.value());
+            }
+            endObject();
+            break;
+        case nlohmann::json::value_t::array:
+            startArray();
+            for (auto& it : document)
+                value(it);
+            endArray();
+            break;
+        case nlohmann::json::value_t::string:
+            value(std::string_view(document.get_ref<const std::string&>()));
+            break;
+        case nlohmann::json::value_t::boolean:
+            value(document.get<bool>());
+            break;
+        case nlohmann::json::value_t::number_integer:
+            value(document.get<int64_t>());
+            break;
+        case nlohmann::json::value_t::number_unsigned:
+            value(document.get<uint64_t>());
+            break;
+        case nlohmann::json::value_t::number_float:
+            value(document.get<double>());
+            break;
+        default:
+            null();
+            break;
+    }
+}
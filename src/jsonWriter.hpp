@@ -0,0 +1,118 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "json.hpp"
+
+// Appends str as a quoted json string. Escapes are found 16/32 bytes at a time with SSE2/AVX2,
+// invalid UTF-8 is replaced by U+FFFD instead of failing the whole message.
+void appendJsonString(std::string& out, std::string_view str);
+
+// Shortest representation that parses back to the same double, non finite numbers become null
+void appendJsonNumber(std::string& out, double value);
+void appendJsonNumber(std::string& out, float value);
+void appendJsonNumber(std::string& out, int64_t value);
+void appendJsonNumber(std::string& out, uint64_t value);
+
+// Streams json text straight into a string, takes care of commas.
+// Used for outgoing messages instead of nlohmann::json::dump. The output parses to the same values
+// but isn't byte identical: to_chars writes 1.0 as 1, floats are written as the shortest float
+// and invalid UTF-8 becomes U+FFFD where dump throws. bench/jsonWriterBench.cpp compares the two.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out) : out(out) {}
+
+    void startObject() {
+        separator();
+        out += '{';
+        first.push_back(true);
+    }
+    void endObject() {
+        out += '}';
+        first.pop_back();
+    }
+    void startArray() {
+        separator();
+        out += '[';
+        first.push_back(true);
+    }
+    void endArray() {
+        out += ']';
+        first.pop_back();
+    }
+
+    void key(std::string_view name) {
+        separator();
+        appendJsonString(out, name);
+        out += ':';
+        afterKey = true;
+    }
+
+    void value(std::string_view str) {
+        separator();
+        appendJsonString(out, str);
+    }
+    void value(const char* str) {
+        value(std::string_view(str));
+    }
+    void value(const std::string& str) {
+        value(std::string_view(str));
+    }
+    void value(double number) {
+        separator();
+        appendJsonNumber(out, number);
+    }
+    // SQF numbers are floats, written as the shortest float representation so 0.1 stays 0.1
+    void value(float number) {
+        separator();
+        appendJsonNumber(out, number);
+    }
+    void value(int64_t number) {
+        separator();
+        appendJsonNumber(out, number);
+    }
+    void value(uint64_t number) {
+        separator();
+        appendJsonNumber(out, number);
+    }
+    void value(bool boolean) {
+        separator();
+        out += boolean ? "true" : "false";
+    }
+    void null() {
+        separator();
+        out += "null";
+    }
+
+    // Writes a whole json document
+    void value(const nlohmann::json& document);
+
+    // Inserts already serialized json as a value
+    void raw(std::string_view json) {
+        separator();
+        out += json;
+    }
+
+    std::string& output() {
+        return out;
+    }
+
+private:
+    void separator() {
+        if (afterKey) {
+            afterKey = false;
+            return;
+        }
+        if (first.empty())
+            return;
+        if (!first.back())
+            out += ',';
+        first.back() = false;
+    }
+
+    std::string& out;
+    // One entry per open object/array, true until it has its first element
+    std::vector<bool> first;
+    bool afterKey = false;
+};
@@ -1,6 +1,7 @@
 #include <intercept.hpp>
 #include <boost/beast.hpp>
 #include "websocket.hpp"
+#include "codeCache.hpp"
 
 int intercept::api_version() { //This is required for the plugin to work.
     return INTERCEPT_SDK_API_VERSION;
@@ -18,9 +19,12 @@ void intercept::pre_start() {
 void intercept::pre_init() {
     intercept::sqf::system_chat("The Intercept template plugin is running!");
 }
-extern std::set<std::shared_ptr<websocket_session>> wsSessions;
+void intercept::mission_ended() {
+    // Compiled code and functions of the old mission must not be run in the next one
+    clearCodeCaches();
+    TaskScheduler::missionEnded();
+}
+
 void intercept::on_frame() {
-    for (auto& it : wsSessions) {
-        it->processTasks();
-    }
+    TaskScheduler::runFrame();
 }
\ No newline at end of file
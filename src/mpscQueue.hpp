@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue for many producers and a single consumer.
+// Based on Dmitry Vyukov's bounded MPMC queue, the consumer side is simplified
+// because only one thread (or strand) ever pops.
+// Neither push nor pop ever block, they fail if the queue is full/empty.
+// The capacity is rounded up to a power of two, the cells are allocated once up front.
+template<class T>
+class MPSCQueue {
+    struct cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t value) {
+        size_t result = 2;
+        while (result < value)
+            result <<= 1;
+        return result;
+    }
+
+    const size_t capacity;
+    const size_t mask;
+    std::unique_ptr<cell[]> cells;
+    alignas(64) std::atomic<size_t> enqueuePos{ 0 };
+    alignas(64) size_t dequeuePos = 0;
+
+public:
+    explicit MPSCQueue(size_t minCapacity) : capacity(roundUpToPowerOfTwo(minCapacity)), mask(capacity - 1), cells(new cell[capacity]) {
+        for (size_t i = 0; i < capacity; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    // Can be called from any thread. Returns false if the queue is full, value is left untouched then.
+    bool try_push(T&& value) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& target = cells[pos & mask];
+            const size_t seq = target.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    target.data = std::move(value);
+                    target.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only the consumer may call this
+    bool try_pop(T& out) {
+        cell& target = cells[dequeuePos & mask];
+        const size_t seq = target.sequence.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(dequeuePos + 1) < 0)
+            return false; // empty, or the producer has not finished writing yet
+
+        out = std::move(target.data);
+        target.data = T{}; // release whatever the moved-from object still holds
+        target.sequence.store(dequeuePos + capacity, std::memory_order_release);
+        ++dequeuePos;
+        return true;
+    }
+
+    // Only the consumer may call this. Approximate if producers are active.
+    bool empty() const {
+        const cell& target = cells[dequeuePos & mask];
+        return static_cast<std::ptrdiff_t>(target.sequence.load(std::memory_order_acquire)) - static_cast<std::ptrdiff_t>(dequeuePos + 1) < 0;
+    }
+};
+
+// Embed this into objects that are put into an IntrusiveMPSCQueue
+struct IntrusiveMPSCNode {
+    std::atomic<IntrusiveMPSCNode*> mpscNext{ nullptr };
+};
+
+// Unbounded lock-free queue for many producers and a single consumer, the queued
+// objects carry their own link so pushing never allocates.
+// Dmitry Vyukov's intrusive MPSC queue. An object may only be queued once at a time.
+template<class T>
+class IntrusiveMPSCQueue {
+    IntrusiveMPSCNode stub;
+    alignas(64) std::atomic<IntrusiveMPSCNode*> head{ &stub };
+    alignas(64) IntrusiveMPSCNode* tail = &stub;
+
+    void pushNode(IntrusiveMPSCNode* node) {
+        node->mpscNext.store(nullptr, std::memory_order_relaxed);
+        auto prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->mpscNext.store(node, std::memory_order_release);
+    }
+
+public:
+    IntrusiveMPSCQueue() = default;
+    IntrusiveMPSCQueue(const IntrusiveMPSCQueue&) = delete;
+    IntrusiveMPSCQueue& operator=(const IntrusiveMPSCQueue&) = delete;
+
+    // Can be called from any thread
+    void push(T* item) {
+        pushNode(static_cast<IntrusiveMPSCNode*>(item));
+    }
+
+    // Only the consumer may call this.
+    // Returns nullptr if empty, or if a producer is in the middle of a push. The item
+    // will then be returned by a later call.
+    T* try_pop() {
+        auto tailNode = tail;
+        auto next = tailNode->mpscNext.load(std::memory_order_acquire);
+        if (tailNode == &stub) {
+            if (!next)
+                return nullptr;
+            tail = next;
+            tailNode = next;
+            next = next->mpscNext.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail = next;
+            return static_cast<T*>(tailNode);
+        }
+        if (tailNode != head.load(std::memory_order_acquire))
+            return nullptr;
+
+        pushNode(&stub);
+        next = tailNode->mpscNext.load(std::memory_order_acquire);
+        if (next) {
+            tail = next;
+            return static_cast<T*>(tailNode);
+        }
+        return nullptr;
+    }
+};
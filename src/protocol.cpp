@@ -0,0 +1,30 @@
+#include "protocol.hpp"
+
+static void appendObject(std::string& out, const char* name, std::initializer_list<const char*> names) {
+    out += "    ";
+    out += name;
+    out += ": {\n";
+    for (auto it : names) {
+        out += "        ";
+        out += it;
+        out += ": \"";
+        out += it;
+        out += "\",\n";
+    }
+    out += "    },\n";
+}
+
+const std::string& protocolJavascript() {
+    static const std::string script = [] {
+        std::string out = "// Generated by the ArmaWebControl plugin from src/protocol.hpp, do not edit\nvar Protocol = {\n";
+#define AWC_STRING_ENTRY(name) #name,
+        appendObject(out, "TaskType", { AWC_TASK_TYPES(AWC_STRING_ENTRY) });
+        appendObject(out, "TaskField", { AWC_TASK_FIELDS(AWC_STRING_ENTRY) });
+        appendObject(out, "ResultType", { AWC_RESULT_TYPES(AWC_STRING_ENTRY) });
+        appendObject(out, "ResultField", { AWC_RESULT_FIELDS(AWC_STRING_ENTRY) });
+#undef AWC_STRING_ENTRY
+        out += "};\n";
+        return out;
+    }();
+    return script;
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// The websocket protocol between the web UI and the plugin.
+// This is the one place where message types and fields are declared. The enums, name
+// tables and lookups below and the /protocol.js module served to the UI are generated from it.
+// To add a message type, add it here, register its handler in tasks.cpp and use it in the UI.
+
+// Task types the client sends
+#define AWC_TASK_TYPES(X) \
+    X(getPlayerlist) \
+    X(Exec) \
+    X(ExecFunc) \
+    X(getServerStats) \
+    X(Prepare) \
+    X(Invoke) \
+    X(Release) \
+    X(Subscribe) \
+    X(Unsubscribe) \
+    X(Cancel) \
+    X(ExecAsync) \
+    X(Pipeline)
+
+// Fields of a task
+#define AWC_TASK_FIELDS(X) \
+    X(type) \
+    X(script) \
+    X(fnc) \
+    X(args) \
+    X(watch) \
+    X(id) \
+    X(priority) \
+    X(handle) \
+    X(noReply) \
+    X(interval) \
+    X(pure) \
+    X(supersede) \
+    X(deadlineMs) \
+    X(target) \
+    X(steps) \
+    X(outputs)
+
+// Message types the plugin sends
+#define AWC_RESULT_TYPES(X) \
+    X(playerlist) \
+    X(ExecRet) \
+    X(serverStats) \
+    X(Prepared) \
+    X(Released) \
+    X(Subscribed) \
+    X(Unsubscribed) \
+    X(Cancelled) \
+    X(Expired) \
+    X(ExecProgress) \
+    X(PipelineRet)
+
+// Fields of messages the plugin sends
+#define AWC_RESULT_FIELDS(X) \
+    X(type) \
+    X(players) \
+    X(res) \
+    X(watch) \
+    X(id) \
+    X(frame) \
+    X(queueUs) \
+    X(gameUs) \
+    X(ioThreads) \
+    X(cpuUs) \
+    X(netId) \
+    X(truncated) \
+    X(stream) \
+    X(chunk) \
+    X(data) \
+    X(final) \
+    X(codeCache) \
+    X(functionCache) \
+    X(frameCache) \
+    X(hits) \
+    X(misses) \
+    X(entries) \
+    X(bytes) \
+    X(handle) \
+    X(error) \
+    X(target) \
+    X(progress) \
+    X(superseded)
+
+// FNV-1a, constexpr so name lookups compile down to a switch over precomputed hashes
+constexpr uint32_t protocolHash(std::string_view str) {
+    uint32_t hash = 2166136261u;
+    for (auto c : str) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+enum class TaskType : uint8_t {
+#define AWC_ENUM_ENTRY(name) name,
+    AWC_TASK_TYPES(AWC_ENUM_ENTRY)
+    count,
+    unknown = count
+};
+
+enum class TaskField : uint8_t {
+    AWC_TASK_FIELDS(AWC_ENUM_ENTRY)
+    count,
+    unknown = count
+#undef AWC_ENUM_ENTRY
+};
+
+#define AWC_NAME_ENTRY(name) #name,
+constexpr std::array<std::string_view, static_cast<size_t>(TaskType::count)> taskTypeNames = { AWC_TASK_TYPES(AWC_NAME_ENTRY) };
+constexpr std::array<std::string_view, static_cast<size_t>(TaskField::count)> taskFieldNames = { AWC_TASK_FIELDS(AWC_NAME_ENTRY) };
+#undef AWC_NAME_ENTRY
+
+// Two names with the same hash are duplicate case labels, so collisions fail to compile
+#define AWC_LOOKUP_CASE(name) case protocolHash(#name): return str == #name ? enumType::name : enumType::unknown;
+
+constexpr TaskType taskTypeFromName(std::string_view str) {
+    using enumType = TaskType;
+    switch (protocolHash(str)) {
+        AWC_TASK_TYPES(AWC_LOOKUP_CASE)
+        default: return TaskType::unknown;
+    }
+}
+
+constexpr TaskField taskFieldFromName(std::string_view str) {
+    using enumType = TaskField;
+    switch (protocolHash(str)) {
+        AWC_TASK_FIELDS(AWC_LOOKUP_CASE)
+        default: return TaskField::unknown;
+    }
+}
+#undef AWC_LOOKUP_CASE
+
+// Interned names for building outgoing messages, result[resultField::type] = resultType::ExecRet
+#define AWC_CONSTANT_ENTRY(name) constexpr const char* name = #name;
+namespace resultType {
+    AWC_RESULT_TYPES(AWC_CONSTANT_ENTRY)
+}
+namespace resultField {
+    AWC_RESULT_FIELDS(AWC_CONSTANT_ENTRY)
+}
+#undef AWC_CONSTANT_ENTRY
+
+// Javascript module with the same names for the web UI, served as /protocol.js
+const std::string& protocolJavascript();
@@ -0,0 +1,136 @@
+#include "scheduler.hpp"
+#include "websocket.hpp"
+#include "config.hpp"
+#include "frameResults.hpp"
+
+// Sessions that got new work since the last frame
+static IntrusiveMPSCQueue<websocket_session> readySessions;
+// Sessions that still have queued tasks, only accessed by the game thread
+static std::vector<std::shared_ptr<websocket_session>> activeSessions;
+// Counts ended missions, sessions compare it with the one their game state belongs to
+static uint32_t currentMission = 0;
+
+void TaskScheduler::markReady(websocket_session& session) {
+    if (session.ready_.exchange(true, std::memory_order_acq_rel))
+        return;
+    session.readySelf = session.shared_from_this();
+    readySessions.push(&session);
+}
+
+void TaskScheduler::runFrame() {
+    while (auto session = readySessions.try_pop()) {
+        auto self = std::move(session->readySelf);
+        // Cleared before we look at the queues, so work that arrives from now on marks it again
+        session->ready_.store(false, std::memory_order_release);
+        if (!session->scheduled) {
+            session->scheduled = true;
+            activeSessions.emplace_back(std::move(self));
+        }
+    }
+
+    if (activeSessions.empty())
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    FrameBudget budget{
+        static_cast<uint32_t>(intercept::sqf::diag_frameno()),
+        now + config.frameBudget,
+        config.frameBudget.count() == 0
+    };
+
+    for (auto& it : activeSessions) {
+        it->forgetEndedMission(currentMission);
+        it->retryPendingResult();
+        it->refillTokens(now);
+    }
+
+    // Streams started in earlier frames go first, one chunk each
+    for (auto& it : activeSessions) {
+        if (!it->closed_) {
+            it->pollAsyncScripts(budget);
+            it->continueStreams(budget);
+        }
+    }
+
+    // Subscriptions replace watch polling, they rank between interactive and background tasks
+    if (!budget.exhausted())
+        runLane(interactiveLane, budget);
+    runSubscriptions(budget);
+    if (!budget.exhausted())
+        runLane(backgroundLane, budget);
+
+    for (auto& it : activeSessions) {
+        it->flushResults();
+    }
+
+    // Shared results are only valid within the frame
+    clearFrameResults();
+
+    // Sessions without work leave until they are marked ready again, closed ones drop what they had queued
+    activeSessions.erase(std::remove_if(activeSessions.begin(), activeSessions.end(), [](const std::shared_ptr<websocket_session>& session) {
+        if (!session->closed_ && (session->pendingResult || session->hasQueuedTasks() || !session->streams.empty() || !session->subscriptions.empty() || !session->asyncScripts.empty()))
+            return false;
+        // Game values have to be released on the game thread
+        if (session->closed_)
+            session->releaseGameState();
+        session->scheduled = false;
+        return true;
+    }), activeSessions.end());
+}
+
+void TaskScheduler::runSubscriptions(FrameBudget& budget) {
+    // Starts at the session the budget ran out at last frame, so the ones late in the list aren't starved
+    static size_t nextSubscriber = 0;
+    const auto count = activeSessions.size();
+    for (size_t i = 0; i < count; ++i) {
+        auto index = (nextSubscriber + i) % count;
+        if (budget.exhausted()) {
+            nextSubscriber = index;
+            return;
+        }
+        auto& session = *activeSessions[index];
+        if (!session.closed_)
+            session.runSubscriptions(budget);
+    }
+}
+
+void TaskScheduler::missionEnded() {
+    // Sessions that aren't scheduled now catch up once they are
+    ++currentMission;
+}
+
+void TaskScheduler::runLane(TaskLane lane, FrameBudget& budget) {
+    // Deficits are kept in nanoseconds, tasks that take less than a microsecond still cost something
+    const auto quantum = std::chrono::duration_cast<std::chrono::nanoseconds>(config.schedulerQuantum).count();
+
+    bool eligible = true;
+    while (eligible && !budget.exhausted()) {
+        eligible = false;
+        for (auto& it : activeSessions) {
+            auto& session = *it;
+            auto& deficit = session.deficit[lane];
+
+            // Classic DRR, an idle queue doesn't get to save up credit
+            if (!session.hasQueuedTasks(lane)) {
+                deficit = 0;
+                continue;
+            }
+            if (session.closed_ || session.pendingResult || !session.hasTokens())
+                continue;
+
+            eligible = true;
+            // At least 1, a tiny weight must still make progress
+            deficit += std::max<int64_t>(1, static_cast<int64_t>(quantum * session.weight));
+
+            // Cost is the measured game thread time, a task can overrun its credit, the debt is paid in later rounds
+            while (deficit > 0 && session.hasTokens() && !session.pendingResult) {
+                if (budget.exhausted())
+                    return;
+                auto start = std::chrono::steady_clock::now();
+                if (!session.runTask(lane, budget))
+                    break;
+                deficit -= std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+    }
+}
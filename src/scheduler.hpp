@@ -0,0 +1,46 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+class websocket_session;
+
+// Priority classes, lower lanes are always served first
+enum TaskLane : size_t {
+    interactiveLane, // One-off commands from a user
+    backgroundLane,  // Periodic things like watch polling
+    laneCount
+};
+
+// Limits how much game thread time tasks can take per frame
+struct FrameBudget {
+    uint32_t frame;
+    std::chrono::steady_clock::time_point deadline;
+    bool unlimited;
+    size_t tasksRun = 0;
+
+    // Always run at least one task per frame so huge tasks can't stall everything
+    bool exhausted() const {
+        return !unlimited && tasksRun != 0 && std::chrono::steady_clock::now() >= deadline;
+    }
+};
+
+// Decides which session's tasks run on the game thread.
+// Lanes are served in priority order, inside a lane sessions share the frame budget by
+// deficit round robin weighted by their configured weight. Each session also has a token
+// bucket that limits how many tasks per second it may run.
+class TaskScheduler {
+public:
+    // Can be called from any thread, queues the session to be looked at in the next frame
+    static void markReady(websocket_session& session);
+
+    // Called from on_frame
+    static void runFrame();
+
+    // Called from mission_ended. Sessions drop what they hold of the old mission before they run anything else
+    static void missionEnded();
+
+private:
+    static void runLane(TaskLane lane, FrameBudget& budget);
+    static void runSubscriptions(FrameBudget& budget);
+};
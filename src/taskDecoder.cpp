@@ -0,0 +1,302 @@
+#include "taskDecoder.hpp"
+#include <limits>
+
+using json = nlohmann::json;
+
+namespace {
+
+// Longer deadlines are ignored, converting them to clock time would overflow
+constexpr uint32_t maxDeadlineMs = 24 * 60 * 60 * 1000;
+
+// SAX handler for json::sax_parse that fills TaskRequests.
+// Tracks where in the document we are: inside a task object, inside one of its pipeline steps
+// (which are task objects themselves), inside args (which may contain nested arrays and
+// {"code": ...}/{"ref": ...} objects), or inside something we don't care about.
+class TaskDecoder {
+public:
+    explicit TaskDecoder(std::vector<TaskRequest>& tasks) : tasks(tasks) {}
+
+    bool null() {
+        switch (route()) {
+            case target::arg: argStack.back()->emplace_back(); break;
+            case target::invalidTask: tasks.emplace_back(); break;
+            default: current = field::unknown; break;
+        }
+        return true;
+    }
+
+    bool boolean(bool value) {
+        switch (route()) {
+            case target::arg: {
+                auto& arg = newArg(TaskArg::kind::boolean);
+                arg.boolean = value;
+            } break;
+            case target::field:
+                if (current == field::id)
+                    task().id = value;
+                else if (current == field::target)
+                    task().target = value;
+                else if (current == field::noReply)
+                    task().noReply = value;
+                else if (current == field::pure)
+                    task().pure = value;
+                current = field::unknown;
+                break;
+            case target::invalidTask: tasks.emplace_back(); break;
+            default: break;
+        }
+        return true;
+    }
+
+    template<class T>
+    bool number(T value) {
+        switch (route()) {
+            case target::arg: {
+                auto& arg = newArg(TaskArg::kind::number);
+                arg.number = static_cast<float>(value);
+            } break;
+            case target::field:
+                if (current == field::id)
+                    task().id = value;
+                else if (current == field::target)
+                    task().target = value;
+                else if (current == field::deadlineMs && value >= 0 && value <= maxDeadlineMs)
+                    task().deadline = std::chrono::milliseconds(static_cast<int64_t>(value));
+                else if (current == field::watch)
+                    task().watch = json(value).dump();
+                else if (current == field::handle && value > 0 && value <= (std::numeric_limits<uint32_t>::max)())
+                    task().handle = static_cast<uint32_t>(value);
+                else if (current == field::interval && value >= 1 && value <= (std::numeric_limits<uint32_t>::max)())
+                    task().interval = static_cast<uint32_t>(value);
+                current = field::unknown;
+                break;
+            case target::invalidTask: tasks.emplace_back(); break;
+            default: break;
+        }
+        return true;
+    }
+
+    bool number_integer(json::number_integer_t value) { return number(value); }
+    bool number_unsigned(json::number_unsigned_t value) { return number(value); }
+    bool number_float(json::number_float_t value, const json::string_t&) { return number(value); }
+
+    bool string(json::string_t& value) {
+        switch (route()) {
+            case target::arg: newArg(TaskArg::kind::string).text = std::move(value); break;
+            case target::codeText: argStack.back()->back().text = std::move(value); break;
+            case target::output: task().outputs.emplace_back(std::move(value)); break;
+            case target::field: setField(value); break;
+            case target::invalidTask: tasks.emplace_back(); break;
+            default: break;
+        }
+        return true;
+    }
+
+    bool start_object(std::size_t) {
+        if (skipDepth) {
+            ++skipDepth;
+        } else if (!argStack.empty()) {
+            if (inCodeObject)
+                skipDepth = 1;
+            else {
+                newArg(TaskArg::kind::code);
+                inCodeObject = true;
+                codeKey = false;
+            }
+        } else if (inSteps && taskStack.size() == 1) {
+            // A pipeline step
+            taskStack.emplace_back(&task().steps.emplace_back());
+            current = field::unknown;
+        } else if (taskStack.empty()) {
+            if (containerDepth > (batch ? 1 : 0)) {
+                // Object nested deeper than a batch element
+                tasks.emplace_back();
+                skipDepth = 1;
+            } else {
+                taskStack.emplace_back(&tasks.emplace_back());
+                current = field::unknown;
+            }
+        } else {
+            // Object as value of a task field
+            skipDepth = 1;
+            current = field::unknown;
+        }
+        ++containerDepth;
+        return true;
+    }
+
+    bool end_object() {
+        --containerDepth;
+        if (skipDepth)
+            --skipDepth;
+        else if (inCodeObject)
+            inCodeObject = false;
+        else if (!taskStack.empty()) {
+            finishTask(task());
+            taskStack.pop_back();
+        }
+        return true;
+    }
+
+    bool start_array(std::size_t) {
+        if (skipDepth) {
+            ++skipDepth;
+        } else if (!argStack.empty()) {
+            if (inCodeObject)
+                skipDepth = 1;
+            else
+                argStack.emplace_back(&newArg(TaskArg::kind::array).elements);
+        } else if (inSteps && taskStack.size() == 1) {
+            // Only objects are steps
+            skipDepth = 1;
+        } else if (!taskStack.empty()) {
+            if (current == field::args)
+                argStack.emplace_back(&task().args);
+            else if (current == field::outputs)
+                inOutputs = true;
+            else if (current == field::steps && taskStack.size() == 1)
+                inSteps = true;
+            else
+                skipDepth = 1;
+            current = field::unknown;
+        } else if (containerDepth == 0) {
+            batch = true;
+        } else {
+            // Array inside the batch array
+            tasks.emplace_back();
+            skipDepth = 1;
+        }
+        ++containerDepth;
+        return true;
+    }
+
+    bool end_array() {
+        --containerDepth;
+        if (skipDepth)
+            --skipDepth;
+        else if (!argStack.empty())
+            argStack.pop_back();
+        else if (inOutputs)
+            inOutputs = false;
+        else if (inSteps && taskStack.size() == 1)
+            inSteps = false;
+        return true;
+    }
+
+    bool key(json::string_t& name) {
+        if (skipDepth)
+            return true;
+        if (inCodeObject) {
+            if (name == "ref")
+                argStack.back()->back().type = TaskArg::kind::ref;
+            codeKey = name == "code" || name == "ref";
+            return true;
+        }
+        if (!taskStack.empty())
+            current = taskFieldFromName(name);
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) {
+        return false;
+    }
+
+private:
+    using field = TaskField;
+
+    // Where a scalar value goes
+    enum class target {
+        ignore,
+        arg,
+        codeText,
+        output,
+        field,
+        invalidTask
+    };
+
+    target route() const {
+        if (skipDepth)
+            return target::ignore;
+        if (inCodeObject)
+            return codeKey ? target::codeText : target::ignore;
+        if (!argStack.empty())
+            return target::arg;
+        if (inOutputs)
+            return target::output;
+        if (inSteps && taskStack.size() == 1)
+            return target::ignore;
+        if (!taskStack.empty())
+            return target::field;
+        // A scalar as the whole message or as batch element
+        return target::invalidTask;
+    }
+
+    TaskRequest& task() {
+        return *taskStack.back();
+    }
+
+    TaskArg& newArg(TaskArg::kind type) {
+        auto& arg = argStack.back()->emplace_back();
+        arg.type = type;
+        return arg;
+    }
+
+    void setField(json::string_t& value) {
+        auto& request = task();
+        switch (current) {
+            case field::type: request.type = taskTypeFromName(value); break;
+            case field::script: request.script = std::move(value); break;
+            case field::fnc: request.fnc = std::move(value); break;
+            case field::watch: request.watch = std::move(value); break;
+            case field::id: request.id = std::move(value); break;
+            case field::target: request.target = std::move(value); break;
+            case field::supersede: request.supersede = std::move(value); break;
+            case field::priority:
+                // Steps run as part of their pipeline, only the pipeline has a lane
+                if (taskStack.size() == 1) {
+                    hasPriority = true;
+                    request.lane = value == "background" ? backgroundLane : interactiveLane;
+                }
+                break;
+            default: break;
+        }
+        current = field::unknown;
+    }
+
+    void finishTask(TaskRequest& request) {
+        if (taskStack.size() != 1)
+            return;
+        // Watch polling refreshes regularly anyway so it can wait, unless the client chose explicitly
+        if (!hasPriority && request.watch)
+            request.lane = backgroundLane;
+        hasPriority = false;
+    }
+
+    std::vector<TaskRequest>& tasks;
+    // The task being decoded, and the step inside it. Pointers stay valid, nothing is added
+    // to a vector while an element of it is on the stack
+    std::vector<TaskRequest*> taskStack;
+    std::vector<std::vector<TaskArg>*> argStack;
+    field current = field::unknown;
+    int containerDepth = 0;
+    int skipDepth = 0;
+    bool batch = false;
+    bool inSteps = false;
+    bool inOutputs = false;
+    bool inCodeObject = false;
+    bool codeKey = false;
+    bool hasPriority = false;
+};
+
+}
+
+bool decodeTasks(const char* data, size_t size, std::vector<TaskRequest>& tasks) {
+    TaskDecoder decoder(tasks);
+    if (json::sax_parse(nlohmann::detail::input_adapter(data, size), &decoder))
+        return true;
+
+    // Answer invalid messages with a single empty result, like a message with an unknown type
+    tasks.clear();
+    tasks.emplace_back();
+    return false;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "tasks.hpp"
+
+// Decodes a websocket message, either a single task object or an array of them,
+// straight from the received bytes into TaskRequests without building a json document.
+// Elements that are not task objects still produce a TaskRequest without handler, so every
+// element gets an answer. Returns false if the message is not valid json.
+bool decodeTasks(const char* data, size_t size, std::vector<TaskRequest>& tasks);
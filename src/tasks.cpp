@@ -0,0 +1,339 @@
+#include "tasks.hpp"
+#include "websocket.hpp"
+#include "threadControl.hpp"
+#include "config.hpp"
+#include "codeCache.hpp"
+#include "frameResults.hpp"
+#include <unordered_map>
+
+TaskRegistry& TaskRegistry::get() {
+    static TaskRegistry registry;
+    return registry;
+}
+
+// Results of earlier pipeline steps, by step id
+using StepResults = std::unordered_map<std::string, game_value>;
+
+// Refs are only resolved inside a pipeline, anywhere else they are nil
+static game_value toGameValue(const TaskArg& arg, const StepResults* steps = nullptr) {
+    switch (arg.type) {
+        case TaskArg::kind::number: return arg.number;
+        case TaskArg::kind::boolean: return arg.boolean;
+        case TaskArg::kind::string: return std::string_view(arg.text);
+        case TaskArg::kind::code: return compileCached(arg.text);
+        case TaskArg::kind::ref: {
+            if (!steps)
+                return {};
+            auto found = steps->find(arg.text);
+            return found != steps->end() ? found->second : game_value();
+        }
+        case TaskArg::kind::array: {
+            auto_array<game_value> elements;
+            for (auto& it : arg.elements) {
+                elements.emplace_back(toGameValue(it, steps));
+            }
+            return elements;
+        }
+        default: return {};
+    }
+}
+
+static auto_array<game_value> toArguments(const std::vector<TaskArg>& args, const StepResults* steps = nullptr) {
+    auto_array<game_value> values;
+    for (auto& it : args) {
+        values.emplace_back(toGameValue(it, steps));
+    }
+    return values;
+}
+
+// Names of all players, for getPlayerlist tasks and pipeline steps
+static game_value playerNames() {
+    auto_array<game_value> names;
+    for (auto& it : intercept::sqf::all_players()) {
+        names.emplace_back(intercept::sqf::name(it));
+    }
+    return names;
+}
+
+static TaskAnswer getPlayerlist(websocket_session&, const TaskRequest&) {
+    TaskAnswer answer;
+    answer.type = resultType::playerlist;
+    answer.res = captureGameValue(playerNames());
+    answer.resField = resultField::players;
+    return answer;
+}
+
+// Only captures the result, turning it into json happens on the IO thread
+TaskAnswer execResult(const game_value& res, const TaskRequest& task) {
+    TaskAnswer answer;
+    answer.type = resultType::ExecRet;
+    if (task.noReply)
+        return answer;
+    if (!config.streamThreshold) {
+        answer.res = captureGameValue(res);
+        return answer;
+    }
+
+    // Anything over the threshold is continued in the next frames
+    auto capture = std::make_unique<GameValueCapture>(res);
+    answer.res.emplace();
+    if (!capture->capture(*answer.res, config.streamThreshold))
+        answer.remaining = std::move(capture);
+    return answer;
+}
+
+// Pure tasks run once per frame, however many sessions ask for the same thing
+template<class Run>
+static TaskAnswer execShared(const TaskRequest& task, Run&& run) {
+    if (!task.pure)
+        return execResult(run(), task);
+
+    auto key = frameResultKey(task);
+    if (auto cached = findFrameResult(key)) {
+        if (!cached->tape || task.noReply)
+            return execResult(cached->value, task);
+        TaskAnswer answer;
+        answer.type = resultType::ExecRet;
+        answer.res = *cached->tape;
+        return answer;
+    }
+
+    auto& stored = storeFrameResult(std::move(key), run());
+    auto answer = execResult(stored.value, task);
+    if (answer.res && !answer.remaining)
+        stored.tape = answer.res;
+    return answer;
+}
+
+static TaskAnswer exec(websocket_session&, const TaskRequest& task) {
+    return execShared(task, [&task] {
+        return intercept::sqf::call(compileCached(task.script));
+    });
+}
+
+static TaskAnswer execFunc(websocket_session&, const TaskRequest& task) {
+    return execShared(task, [&task] {
+        auto func = missionFunctionCached(task.fnc);
+
+        return intercept::sqf::call(func, toArguments(task.args));
+    });
+}
+
+// Runs the script as a scheduled script, so a heavy one doesn't stall the frame.
+// The session polls it every frame and answers once it is done
+static TaskAnswer execAsync(websocket_session& session, const TaskRequest& task) {
+    TaskAnswer answer;
+    answer.type = resultType::ExecRet;
+    if (!session.canStartAsyncScript()) {
+        answer.fields[resultField::error] = "too many async scripts";
+        return answer;
+    }
+
+    // Stores [result] once the script returned. _awcProgressVar is visible to the script,
+    // it reports progress with: missionNamespace setVariable [_awcProgressVar, value]
+    static const char* wrapper =
+        "params [\"_awcResultVar\", \"_awcProgressVar\", \"_awcCode\", \"_awcArgs\"];"
+        "missionNamespace setVariable [_awcResultVar, [_awcArgs call _awcCode]];";
+    static uint64_t nextAsyncId = 0;
+    auto asyncId = std::to_string(++nextAsyncId);
+    auto resultVar = "awc_async_result_" + asyncId;
+    auto progressVar = "awc_async_progress_" + asyncId;
+
+    auto_array<game_value> params;
+    params.emplace_back(resultVar);
+    params.emplace_back(progressVar);
+    params.emplace_back(compileCached(task.script));
+    params.emplace_back(toArguments(task.args));
+
+    auto handle = intercept::sqf::spawn(std::move(params), compileCached(wrapper));
+    session.trackAsyncScript(task, std::move(handle), std::move(resultVar), std::move(progressVar));
+    answer.deferred = true;
+    return answer;
+}
+
+static TaskAnswer prepare(websocket_session& session, const TaskRequest& task) {
+    TaskAnswer answer;
+    answer.type = resultType::Prepared;
+    if (auto handle = session.prepareScript(compileCached(task.script)))
+        answer.fields[resultField::handle] = handle;
+    else
+        answer.fields[resultField::error] = "too many prepared scripts";
+    return answer;
+}
+
+// The arguments are bound as _this, the script was compiled by Prepare
+static TaskAnswer invoke(websocket_session& session, const TaskRequest& task) {
+    auto script = session.preparedScript(task.handle);
+    if (!script) {
+        TaskAnswer answer;
+        answer.type = resultType::ExecRet;
+        answer.fields[resultField::error] = "unknown handle";
+        return answer;
+    }
+
+    auto res = intercept::sqf::call(*script, toArguments(task.args));
+    return execResult(res, task);
+}
+
+static TaskAnswer release(websocket_session& session, const TaskRequest& task) {
+    TaskAnswer answer;
+    answer.type = resultType::Released;
+    answer.fields[resultField::handle] = task.handle;
+    if (!session.releaseScript(task.handle))
+        answer.fields[resultField::error] = "unknown handle";
+    return answer;
+}
+
+static TaskAnswer subscribe(websocket_session& session, const TaskRequest& task) {
+    TaskAnswer answer;
+    answer.type = resultType::Subscribed;
+    if (auto handle = session.subscribe(task, compileCached(task.script)))
+        answer.fields[resultField::handle] = handle;
+    else
+        answer.fields[resultField::error] = "too many subscriptions";
+    return answer;
+}
+
+static TaskAnswer unsubscribe(websocket_session& session, const TaskRequest& task) {
+    TaskAnswer answer;
+    answer.type = resultType::Unsubscribed;
+    if (!session.unsubscribe(task.handle, task.watch))
+        answer.fields[resultField::error] = "unknown subscription";
+    return answer;
+}
+
+// The name other steps reference a step by
+static std::string stepName(const TaskRequest& step) {
+    return step.id.is_string() ? step.id.get<std::string>() : step.id.dump();
+}
+
+// A ref to a step that didn't run before this one
+static const std::string* missingRef(const std::vector<TaskArg>& args, const StepResults& steps) {
+    for (auto& it : args) {
+        if (it.type == TaskArg::kind::ref && !steps.count(it.text))
+            return &it.text;
+        if (it.type == TaskArg::kind::array) {
+            if (auto missing = missingRef(it.elements, steps))
+                return missing;
+        }
+    }
+    return nullptr;
+}
+
+static game_value runStep(websocket_session& session, const TaskRequest& step, const StepResults& steps, std::string& error) {
+    if (auto missing = missingRef(step.args, steps)) {
+        error = "unknown ref " + *missing;
+        return {};
+    }
+
+    switch (step.type) {
+        case TaskType::Exec:
+            if (step.args.empty())
+                return intercept::sqf::call(compileCached(step.script));
+            return intercept::sqf::call(compileCached(step.script), toArguments(step.args, &steps));
+        case TaskType::ExecFunc:
+            return intercept::sqf::call(missionFunctionCached(step.fnc), toArguments(step.args, &steps));
+        case TaskType::Invoke: {
+            auto script = session.preparedScript(step.handle);
+            if (!script) {
+                error = "unknown handle";
+                return {};
+            }
+            return intercept::sqf::call(*script, toArguments(step.args, &steps));
+        }
+        case TaskType::getPlayerlist:
+            return playerNames();
+        default:
+            error = "unsupported step type";
+            return {};
+    }
+}
+
+// Runs all steps in order within this frame, later steps use earlier results through {"ref": id} args.
+// Only the requested outputs are sent, in the order of outputs, or the last step's result if there are none
+static TaskAnswer pipeline(websocket_session& session, const TaskRequest& task) {
+    auto failed = [](std::string error) {
+        TaskAnswer answer;
+        answer.type = resultType::PipelineRet;
+        answer.fields[resultField::error] = std::move(error);
+        return answer;
+    };
+
+    if (task.steps.size() > config.maxPipelineSteps)
+        return failed("too many steps, at most " + std::to_string(config.maxPipelineSteps));
+    // Each step is a task of its own for the rate limit
+    if (task.steps.size() > 1)
+        session.chargeTokens(task.steps.size() - 1);
+
+    StepResults steps;
+    game_value last;
+    for (size_t i = 0; i < task.steps.size(); ++i) {
+        auto& step = task.steps[i];
+        std::string error;
+        last = runStep(session, step, steps, error);
+        if (!error.empty())
+            return failed("step " + std::to_string(i) + ": " + error);
+        if (!step.id.is_null())
+            steps[stepName(step)] = last;
+    }
+
+    game_value output = last;
+    if (!task.outputs.empty()) {
+        auto_array<game_value> values;
+        for (auto& it : task.outputs) {
+            auto found = steps.find(it);
+            if (found == steps.end())
+                return failed("unknown output " + it);
+            values.emplace_back(found->second);
+        }
+        output = std::move(values);
+    }
+
+    auto answer = execResult(output, task);
+    answer.type = resultType::PipelineRet;
+    return answer;
+}
+
+static json cacheStats(const CodeCacheStats& stats) {
+    return json{
+        { resultField::hits, stats.hits },
+        { resultField::misses, stats.misses },
+        { resultField::entries, stats.entries },
+        { resultField::bytes, stats.bytes }
+    };
+}
+
+static TaskAnswer getServerStats(websocket_session&, const TaskRequest&) {
+    json threads = json::array();
+    for (auto& it : ioThreadCpuTimes()) {
+        threads.emplace_back(json{ { resultField::cpuUs, it.count() } });
+    }
+
+    TaskAnswer answer;
+    answer.type = resultType::serverStats;
+    answer.fields[resultField::ioThreads] = std::move(threads);
+    answer.fields[resultField::codeCache] = cacheStats(compiledCodeStats());
+    answer.fields[resultField::functionCache] = cacheStats(missionFunctionStats());
+    auto frameStats = frameResultStats();
+    answer.fields[resultField::frameCache] = json{
+        { resultField::hits, frameStats.hits },
+        { resultField::misses, frameStats.misses }
+    };
+    return answer;
+}
+
+void registerTaskHandlers() {
+    auto& registry = TaskRegistry::get();
+    registry.registerHandler(TaskType::getPlayerlist, getPlayerlist);
+    registry.registerHandler(TaskType::Exec, exec);
+    registry.registerHandler(TaskType::ExecFunc, execFunc);
+    registry.registerHandler(TaskType::getServerStats, getServerStats);
+    registry.registerHandler(TaskType::Prepare, prepare);
+    registry.registerHandler(TaskType::Invoke, invoke);
+    registry.registerHandler(TaskType::Release, release);
+    registry.registerHandler(TaskType::Subscribe, subscribe);
+    registry.registerHandler(TaskType::Unsubscribe, unsubscribe);
+    registry.registerHandler(TaskType::ExecAsync, execAsync);
+    registry.registerHandler(TaskType::Pipeline, pipeline);
+    // Cancel has no handler, it is answered on the strand in on_read before the game thread sees anything
+}
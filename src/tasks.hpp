@@ -0,0 +1,114 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <string_view>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "json.hpp"
+#include "scheduler.hpp"
+#include "protocol.hpp"
+#include "valueTape.hpp"
+
+class websocket_session;
+struct TaskRequest;
+
+// What a task handler produces on the game thread. The message is built and
+// serialized from it later on an IO thread.
+struct TaskAnswer {
+    // resultType name, nullptr if there is no answer (unknown task type)
+    const char* type = nullptr;
+    // Captured result, written as resField
+    std::optional<ValueTape> res;
+    const char* resField = resultField::res;
+    // Set if res is only the first part of a huge result, the rest is captured in later frames and streamed
+    std::unique_ptr<GameValueCapture> remaining;
+    // Any other fields, for messages that are rare enough that building json here doesn't matter
+    nlohmann::json fields;
+    // The task keeps running (ExecAsync), its result is sent once it is done
+    bool deferred = false;
+
+    bool failed() const {
+        return !type || fields.count(resultField::error);
+    }
+};
+
+// Maps a message type to the function that processes it.
+// Built once at startup before the IO threads run, read only afterwards.
+class TaskRegistry {
+public:
+    using handler = std::function<TaskAnswer(websocket_session&, const TaskRequest&)>;
+
+    static TaskRegistry& get();
+
+    void registerHandler(TaskType type, handler func) {
+        handlers[static_cast<size_t>(type)] = std::move(func);
+    }
+
+    // Returns nullptr if there is no handler for that type
+    const handler* find(TaskType type) const {
+        if (type == TaskType::unknown || !handlers[static_cast<size_t>(type)])
+            return nullptr;
+        return &handlers[static_cast<size_t>(type)];
+    }
+
+private:
+    std::array<handler, static_cast<size_t>(TaskType::count)> handlers;
+};
+
+// An argument for ExecFunc
+struct TaskArg {
+    enum class kind : uint8_t {
+        nil,
+        number,
+        boolean,
+        string,
+        code,  // {"code": "..."}, text is compiled
+        ref,   // {"ref": "..."}, in a pipeline step the result of the earlier step with that id
+        array
+    };
+
+    kind type = kind::nil;
+    bool boolean = false;
+    float number = 0;
+    std::string text;
+    std::vector<TaskArg> elements;
+};
+
+// A decoded incoming task
+struct TaskRequest {
+    TaskType type = TaskType::unknown;
+    std::string script;
+    std::string fnc;
+    std::vector<TaskArg> args;
+    std::optional<std::string> watch;
+    // Prepared script for Invoke and Release, 0 is never a valid handle
+    uint32_t handle = 0;
+    // Fire and forget, the result is neither captured nor sent. Only failures are reported
+    bool noReply = false;
+    // Side effect free, sessions asking for the same script or function and arguments
+    // in the same frame share one evaluation. Not for Invoke, handles are per session
+    bool pure = false;
+    // Frames between evaluations of a Subscribe expression
+    uint32_t interval = 1;
+    // A newer task with the same key withdraws this one if it hasn't run yet. Defaults to watch
+    std::optional<std::string> supersede;
+    // Dropped unexecuted if it couldn't start within that time after it arrived. At most a day, longer means none
+    std::optional<std::chrono::milliseconds> deadline;
+    // Cancel: the id of the task to withdraw
+    nlohmann::json target;
+    // Pipeline: tasks run in order in one frame, and the ids of the steps whose results are sent
+    std::vector<TaskRequest> steps;
+    std::vector<std::string> outputs;
+    // Client supplied request id, copied into the answer. Null if there was none
+    nlohmann::json id;
+    TaskLane lane = interactiveLane;
+};
+
+// Registers all builtin message types
+void registerTaskHandlers();
+
+// Game thread only. The ExecRet answer for a script result, huge ones continue as a stream
+TaskAnswer execResult(const game_value& res, const TaskRequest& task);
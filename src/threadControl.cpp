@@ -0,0 +1,112 @@
+#include "threadControl.hpp"
+#include "config.hpp"
+#include <iostream>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+using thread_id = HANDLE;
+#else
+using thread_id = clockid_t;
+#endif
+
+static std::mutex ioThreadsMutex;
+static std::vector<thread_id> ioThreads;
+
+static void applyAffinity() {
+    if (config.ioAffinity.empty())
+        return;
+
+#ifdef _WIN32
+    DWORD_PTR mask = 0;
+    for (auto cpu : config.ioAffinity) {
+        if (cpu < sizeof(DWORD_PTR) * 8)
+            mask |= DWORD_PTR(1) << cpu;
+    }
+    if (!SetThreadAffinityMask(GetCurrentThread(), mask))
+        std::cerr << "ioAffinity: SetThreadAffinityMask failed " << GetLastError() << "\n";
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : config.ioAffinity) {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    if (auto error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        std::cerr << "ioAffinity: pthread_setaffinity_np failed " << error << "\n";
+#endif
+}
+
+static void applyPriority() {
+    if (config.ioPriority == "normal")
+        return;
+    const bool idle = config.ioPriority == "idle";
+
+#ifdef _WIN32
+    if (!SetThreadPriority(GetCurrentThread(), idle ? THREAD_PRIORITY_IDLE : THREAD_PRIORITY_BELOW_NORMAL))
+        std::cerr << "ioPriority: SetThreadPriority failed " << GetLastError() << "\n";
+#else
+    if (idle) {
+        // Only gets cpu time nothing else wants
+        sched_param param{};
+        if (sched_setscheduler(0, SCHED_IDLE, &param) == 0)
+            return;
+        std::cerr << "ioPriority: SCHED_IDLE not available, falling back to nice\n";
+    }
+    // On Linux the nice value is per thread
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), idle ? 19 : 10) != 0)
+        std::cerr << "ioPriority: setpriority failed\n";
+#endif
+}
+
+void setupIoThread() {
+    applyAffinity();
+    applyPriority();
+
+    thread_id id;
+#ifdef _WIN32
+    id = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, GetCurrentThreadId());
+    if (!id)
+        return;
+#else
+    if (pthread_getcpuclockid(pthread_self(), &id) != 0)
+        return;
+#endif
+    std::lock_guard<std::mutex> lock(ioThreadsMutex);
+    ioThreads.emplace_back(id);
+}
+
+std::vector<std::chrono::microseconds> ioThreadCpuTimes() {
+    std::vector<std::chrono::microseconds> result;
+    std::lock_guard<std::mutex> lock(ioThreadsMutex);
+    result.reserve(ioThreads.size());
+    for (auto& it : ioThreads) {
+#ifdef _WIN32
+        FILETIME creation, exit, kernel, user;
+        if (!GetThreadTimes(it, &creation, &exit, &kernel, &user)) {
+            result.emplace_back(0);
+            continue;
+        }
+        auto toTicks = [](const FILETIME& time) {
+            return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+        };
+        // FILETIME is in 100ns steps
+        result.emplace_back((toTicks(kernel) + toTicks(user)) / 10);
+#else
+        timespec time{};
+        clock_gettime(it, &time);
+        result.emplace_back(std::chrono::seconds(time.tv_sec) + std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(time.tv_nsec)));
+#endif
+    }
+    return result;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <chrono>
+#include <vector>
+
+// Called first thing on every IO thread. Applies the configured CPU affinity and
+// scheduling priority, and registers the thread for the cpu time statistics
+void setupIoThread();
+
+// CPU time (user + kernel) each IO thread used so far
+std::vector<std::chrono::microseconds> ioThreadCpuTimes();
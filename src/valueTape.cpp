@@ -0,0 +1,106 @@
+#include "valueTape.hpp"
+#include "config.hpp"
+#include "protocol.hpp"
+
+GameValueCapture::GameValueCapture(game_value value) : root(std::move(value)), elementsLeft(config.resultMaxElements) {}
+
+bool GameValueCapture::capture(ValueTape& tape, size_t maxValues) {
+    size_t captured = 0;
+    if (!started) {
+        started = true;
+        captureValue(root, tape);
+        ++captured;
+    }
+
+    while (!stack.empty() && captured < maxValues) {
+        auto& top = stack.back();
+        auto& elements = top.array.to_array();
+        // >=, the array may have shrunk since the last call
+        if (top.index >= elements.size() || !elementsLeft) {
+            if (top.index < elements.size())
+                tape.truncated = true;
+            tape.endArray();
+            stack.pop_back();
+            continue;
+        }
+
+        // Copied, pushing a nested array may move the stack
+        game_value element = elements[top.index++];
+        captureValue(element, tape);
+        ++captured;
+    }
+    return stack.empty();
+}
+
+void GameValueCapture::captureValue(const game_value& value, ValueTape& tape) {
+    if (!elementsLeft) {
+        tape.truncated = true;
+        return tape.null();
+    }
+    --elementsLeft;
+
+    switch (value.type_enum()) {
+        case game_data_type::SCALAR:
+            return tape.number(static_cast<float>(value));
+        case game_data_type::BOOL:
+            return tape.boolean(static_cast<bool>(value));
+        case game_data_type::STRING: {
+            auto str = static_cast<r_string>(value);
+            return tape.string(std::string_view(str.data(), str.length()));
+        }
+        case game_data_type::ARRAY:
+            if (stack.size() >= config.resultMaxDepth) {
+                tape.truncated = true;
+                return tape.null();
+            }
+            // The elements are captured by the loop in capture
+            tape.startArray();
+            stack.push_back({ value, 0 });
+            return;
+        case game_data_type::OBJECT:
+            if (value.is_null())
+                return tape.null();
+            return tape.handle(intercept::sqf::net_id(static_cast<object>(value)));
+        case game_data_type::GROUP:
+            if (value.is_null())
+                return tape.null();
+            return tape.handle(intercept::sqf::net_id(static_cast<group>(value)));
+        case game_data_type::NOTHING:
+            return tape.null();
+        default:
+            return tape.string(static_cast<std::string>(value));
+    }
+}
+
+ValueTape captureGameValue(const game_value& value) {
+    ValueTape tape;
+    GameValueCapture capture(value);
+    capture.capture(tape, SIZE_MAX);
+    return tape;
+}
+
+void writeValueTape(JsonWriter& writer, const ValueTape& tape) {
+    size_t textOffset = 0;
+    auto nextText = [&](const ValueTape::entry& entry) {
+        std::string_view text(tape.text.data() + textOffset, entry.length);
+        textOffset += entry.length;
+        return text;
+    };
+
+    for (auto& it : tape.entries) {
+        switch (it.type) {
+            case ValueTape::token::null: writer.null(); break;
+            case ValueTape::token::boolean: writer.value(it.boolean); break;
+            case ValueTape::token::number: writer.value(it.number); break;
+            case ValueTape::token::string: writer.value(nextText(it)); break;
+            case ValueTape::token::handle:
+                writer.startObject();
+                writer.key(resultField::netId);
+                writer.value(nextText(it));
+                writer.endObject();
+                break;
+            case ValueTape::token::arrayStart: writer.startArray(); break;
+            case ValueTape::token::arrayEnd: writer.endArray(); break;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <intercept.hpp>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "jsonWriter.hpp"
+
+// An immutable copy of a game_value that doesn't reference engine memory.
+// The game thread captures it in one pass that only copies bytes, turning it into json
+// (escaping, number formatting) happens later on an IO thread.
+class ValueTape {
+public:
+    enum class token : uint8_t {
+        null,
+        boolean,
+        number,
+        string,
+        handle,    // Object or group, text is its netId
+        arrayStart,
+        arrayEnd
+    };
+
+    struct entry {
+        token type;
+        bool boolean;
+        uint32_t length; // Bytes in text for string and handle
+        float number;
+    };
+
+    std::vector<entry> entries;
+    // Content of all strings and handles, in entry order
+    std::string text;
+    // Something was cut off by the depth or element limits
+    bool truncated = false;
+
+    void null() {
+        entries.push_back({ token::null, false, 0, 0 });
+    }
+    void boolean(bool value) {
+        entries.push_back({ token::boolean, value, 0, 0 });
+    }
+    void number(float value) {
+        entries.push_back({ token::number, false, 0, value });
+    }
+    void string(std::string_view value) {
+        entries.push_back({ token::string, false, static_cast<uint32_t>(value.size()), 0 });
+        text.append(value.data(), value.size());
+    }
+    void handle(std::string_view netId) {
+        entries.push_back({ token::handle, false, static_cast<uint32_t>(netId.size()), 0 });
+        text.append(netId.data(), netId.size());
+    }
+    void startArray() {
+        entries.push_back({ token::arrayStart, false, 0, 0 });
+    }
+    void endArray() {
+        entries.push_back({ token::arrayEnd, false, 0, 0 });
+    }
+};
+
+// Game thread only. Arrays, numbers, booleans and strings keep their type, nil becomes null,
+// objects and groups become netId handles and anything else its SQF string.
+// Nesting deeper than resultMaxDepth, or more than resultMaxElements values in total, are cut off.
+//
+// A huge value can be captured over several calls, each appending the next part to a new tape.
+// The arrays that aren't finished yet are referenced, so they stay alive in between. They are not
+// copied, SQF arrays are shared: if mission code changes one in between, the result is torn, parts
+// of it are from before the change and parts from after. Elements it removed are just not captured.
+class GameValueCapture {
+public:
+    explicit GameValueCapture(game_value value);
+
+    // Appends up to maxValues more values to tape, returns true once everything is captured
+    bool capture(ValueTape& tape, size_t maxValues);
+
+private:
+    struct openArray {
+        game_value array;
+        size_t index;
+    };
+
+    void captureValue(const game_value& value, ValueTape& tape);
+
+    game_value root;
+    bool started = false;
+    std::vector<openArray> stack;
+    size_t elementsLeft;
+};
+
+// Captures the whole value at once
+ValueTape captureGameValue(const game_value& value);
+
+// Any thread. Handles are written as {"netId": "..."}
+void writeValueTape(JsonWriter& writer, const ValueTape& tape);
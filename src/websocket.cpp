@@ -1,9 +1,12 @@
 #include "websocket.hpp"
+#include "taskDecoder.hpp"
+#include "jsonWriter.hpp"
+#include "config.hpp"
+#include "threadControl.hpp"
+#include "frameResults.hpp"
 
 extern std::mutex frameLock;
 
-std::set<std::shared_ptr<websocket_session>> wsSessions;
-
 // Return a reasonable mime type based on the extension of a file.
 boost::beast::string_view
 mime_type(boost::beast::string_view path)
@@ -130,6 +133,27 @@ template<
         req.target().find("..") != boost::beast::string_view::npos)
         return send(bad_request("Illegal request-target"));
 
+    // Generated from the protocol declaration, not a file
+    if (req.target() == "/protocol.js") {
+        auto& script = protocolJavascript();
+        if (req.method() == http::verb::head) {
+            http::response<http::empty_body> res{ http::status::ok, req.version() };
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/javascript");
+            res.content_length(script.size());
+            res.keep_alive(req.keep_alive());
+            return send(std::move(res));
+        }
+
+        http::response<http::string_body> res{ http::status::ok, req.version() };
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "application/javascript");
+        res.keep_alive(req.keep_alive());
+        res.body() = script;
+        res.prepare_payload();
+        return send(std::move(res));
+    }
+
     // Build the path to the requested file
     std::string path = path_cat(doc_root, req.target());
     if (req.target().back() == '/')
@@ -198,10 +222,23 @@ void fail(boost::system::error_code ec, char const* what) {
     std::cerr << what << ": " << ec.message() << "\n";
 }
 
+size_t websocket_session::taskQueueCapacity() {
+    return (std::min)(config.maxInFlight, size_t(1024));
+}
+
 websocket_session::websocket_session(tcp::socket socket): ws_(std::move(socket))
     , strand_(ws_.get_executor())
     , timer_(ws_.get_executor().context(),
-        (std::chrono::steady_clock::time_point::max)()) {}
+        (std::chrono::steady_clock::time_point::max)())
+    , todoTasks{ MPSCQueue<Task>(taskQueueCapacity()), MPSCQueue<Task>(taskQueueCapacity()) }
+    , completedTasks(taskQueueCapacity()) {
+    static_assert(laneCount == 2, "todoTasks needs one queue per lane");
+    boost::system::error_code ec;
+    auto remote = ws_.next_layer().remote_endpoint(ec);
+    weight = (std::max)(config.weightFor(ec ? std::string() : remote.address().to_string()), 0.01);
+    tokens = config.rateBurst;
+    tokensUpdated = std::chrono::steady_clock::now();
+}
 
 void websocket_session::on_accept(boost::system::error_code ec) {
     // Happens when the timer closes the socket
@@ -296,6 +333,10 @@ void websocket_session::on_control_callback(websocket::frame_type kind, boost::b
 }
 
 void websocket_session::do_read() {
+    if (read_pending_)
+        return;
+    read_pending_ = true;
+
     // Read a message into our buffer
     ws_.async_read(
         buffer_,
@@ -308,146 +349,856 @@ void websocket_session::do_read() {
                 std::placeholders::_2)));
 }
 
-json websocket_session::processTask(const json& task) {
-    //#TODO make unordered_map with std::function
-    if (task["type"] == "getPlayerlist") {
+TaskAnswer websocket_session::processTask(const TaskRequest& task) {
+    auto handler = TaskRegistry::get().find(task.type);
+    if (!handler)
+        return {};
+
+    return (*handler)(*this, task);
+}
+
+uint32_t websocket_session::prepareScript(code compiled) {
+    if (preparedScripts.size() >= config.maxPreparedScripts)
+        return 0;
+    // Skips 0 when it wraps around, and any handle that is still taken
+    while (!nextPreparedHandle || preparedScripts.count(nextPreparedHandle))
+        ++nextPreparedHandle;
+    auto handle = nextPreparedHandle++;
+    preparedScripts.emplace(handle, std::move(compiled));
+    return handle;
+}
+
+const code* websocket_session::preparedScript(uint32_t handle) const {
+    auto found = preparedScripts.find(handle);
+    return found != preparedScripts.end() ? &found->second : nullptr;
+}
+
+bool websocket_session::releaseScript(uint32_t handle) {
+    return preparedScripts.erase(handle) != 0;
+}
+
+uint32_t websocket_session::subscribe(const TaskRequest& task, code script) {
+    auto found = std::find_if(subscriptions.begin(), subscriptions.end(), [&task](const subscription& it) {
+        return task.watch && it.request.watch == task.watch;
+    });
+    if (found != subscriptions.end()) {
+        // Same target, the new expression takes over and is sent once at least
+        *found = subscription{ found->handle, std::move(script), 0, std::nullopt, task };
+        return found->handle;
+    }
 
-        std::vector<std::string> unitNames;
-        for (auto& it : intercept::sqf::all_players()) {
-            unitNames.emplace_back(intercept::sqf::name(it));
+    if (subscriptions.size() >= config.maxSubscriptions)
+        return 0;
+    while (!nextSubscriptionHandle || std::any_of(subscriptions.begin(), subscriptions.end(), [this](const subscription& it) {
+        return it.handle == nextSubscriptionHandle;
+    }))
+        ++nextSubscriptionHandle;
+    auto handle = nextSubscriptionHandle++;
+    // Due right away, nextFrame 0 is never in the future
+    subscriptions.push_back(subscription{ handle, std::move(script), 0, std::nullopt, task });
+    return handle;
+}
+
+bool websocket_session::unsubscribe(uint32_t handle, const std::optional<std::string>& watch) {
+    auto found = std::find_if(subscriptions.begin(), subscriptions.end(), [&](const subscription& it) {
+        return handle ? it.handle == handle : watch && it.request.watch == watch;
+    });
+    if (found == subscriptions.end())
+        return false;
+    subscriptions.erase(found);
+    return true;
+}
+
+bool websocket_session::canStartAsyncScript() const {
+    return asyncScripts.size() < config.maxAsyncScripts;
+}
+
+void websocket_session::trackAsyncScript(const TaskRequest& task, script handle, std::string resultVar, std::string progressVar) {
+    asyncScripts.push_back(asyncScript{
+        std::move(handle),
+        std::move(resultVar),
+        std::move(progressVar),
+        std::nullopt,
+        std::chrono::steady_clock::now(),
+        runningTask->queued,
+        runningTask->text,
+        task,
+        runningTask->cancel
+    });
+}
+
+void websocket_session::stopAsyncScript(asyncScript& running) {
+    if (!intercept::sqf::script_done(running.handle))
+        intercept::sqf::terminate(running.handle);
+    auto ns = intercept::sqf::mission_namespace();
+    intercept::sqf::set_variable(ns, running.resultVar, game_value());
+    intercept::sqf::set_variable(ns, running.progressVar, game_value());
+}
+
+void websocket_session::pollAsyncScripts(FrameBudget& budget) {
+    auto it = asyncScripts.begin();
+    while (it != asyncScripts.end()) {
+        if (pendingResult || budget.exhausted()) {
+            // The ones that didn't get their turn go first next frame
+            std::rotate(asyncScripts.begin(), it, asyncScripts.end());
+            return;
+        }
+        if (it->cancel && it->cancel->isCancelled()) {
+            stopAsyncScript(*it);
+            TaskResult result;
+            result.silent = true;
+            result.cancel = std::move(it->cancel);
+            completeResult(std::move(result));
+            it = asyncScripts.erase(it);
+            continue;
         }
 
-        json playerMessage;
-        playerMessage["type"] = "playerlist";
-        playerMessage["players"] = unitNames;
-
-        return playerMessage;
-    } else if (task["type"] == "Exec") {
-        auto res = intercept::sqf::call(intercept::sqf::compile(static_cast<std::string_view>(task["script"])));
-
-        json playerMessage;
-        playerMessage["type"] = "ExecRet";
-        playerMessage["res"] = static_cast<std::string>(res);
-        if (task.find("watch") != task.end())
-            playerMessage["watch"] = task["watch"];
-
-        return playerMessage;
-    } else if (task["type"] == "ExecFunc") {
-        auto func = intercept::sqf::get_variable(intercept::sqf::mission_namespace(),
-            static_cast<std::string_view>(task["fnc"]));
-
-        auto_array<game_value> args;
-        for (auto& it : task["args"]) {
-            if (it.is_number())
-                args.emplace_back(static_cast<float>(it));
-            else if (it.is_string())
-                args.emplace_back(static_cast<std::string_view>(it));
-            else if (it.is_boolean())
-                args.emplace_back(static_cast<bool>(it));
-            else if (it.is_object())
-                args.emplace_back(intercept::sqf::compile(static_cast<std::string_view>(it["code"])));
+        auto ns = intercept::sqf::mission_namespace();
+        if (!intercept::sqf::script_done(it->handle)) {
+            // The script sets its progress variable to anything it likes, sent whenever it changes
+            auto progress = intercept::sqf::get_variable(ns, it->progressVar);
+            auto hash = progress.hash();
+            if (!progress.is_nil() && it->lastProgressHash != hash && !it->request.noReply) {
+                it->lastProgressHash = hash;
+                TaskResult result;
+                result.answer.type = resultType::ExecProgress;
+                result.answer.res = captureGameValue(progress);
+                ++budget.tasksRun;
+                result.answer.resField = resultField::progress;
+                // No watch, progress must not replace a result for that watch target
+                result.id = it->request.id;
+                result.frame = budget.frame;
+                result.queueTime = std::chrono::duration_cast<std::chrono::microseconds>(it->started - it->queued);
+                result.gameTime = std::chrono::microseconds(0);
+                result.text = it->text;
+                result.pushed = true;
+                completeResult(std::move(result));
+            }
+            ++it;
+            continue;
         }
 
-        auto res = intercept::sqf::call(func, args);
+        // From here on a Cancel answers "already running". If one came just now, the check above handles it
+        if (it->cancel && !it->cancel->finish())
+            continue;
+
+        // The wrapper stores [result], it is missing if the script failed
+        auto stored = intercept::sqf::get_variable(ns, it->resultVar);
+        stopAsyncScript(*it);
+
+        TaskResult result{
+            TaskAnswer(),
+            it->request.watch,
+            it->request.id,
+            budget.frame,
+            std::chrono::duration_cast<std::chrono::microseconds>(it->started - it->queued),
+            // Scheduled time since the spawn, not game thread time
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - it->started),
+            it->text
+        };
+        result.cancel = std::move(it->cancel);
+        if (stored.type_enum() == game_data_type::ARRAY && stored.to_array().count() == 1) {
+            result.answer = execResult(stored.to_array()[0], it->request);
+            ++budget.tasksRun;
+            if (it->request.noReply) {
+                result.answer = TaskAnswer();
+                result.silent = true;
+            } else if (result.answer.remaining) {
+                startStream(result);
+            }
+        } else {
+            result.answer.type = resultType::ExecRet;
+            result.answer.fields[resultField::error] = "script failed";
+        }
+        completeResult(std::move(result));
+        it = asyncScripts.erase(it);
+    }
+}
+
+void websocket_session::releaseGameState() {
+    streams.clear();
+    preparedScripts.clear();
+    subscriptions.clear();
+    for (auto& it : asyncScripts)
+        stopAsyncScript(it);
+    asyncScripts.clear();
+}
+
+void websocket_session::forgetEndedMission(uint32_t currentMission) {
+    if (mission == currentMission)
+        return;
+    mission = currentMission;
+    preparedScripts.clear();
+    subscriptions.clear();
+}
 
-        json playerMessage;
-        playerMessage["type"] = "ExecRet";
-        playerMessage["res"] = static_cast<std::string>(res);
-        if (task.find("watch") != task.end())
-            playerMessage["watch"] = task["watch"];
-        return playerMessage;
+TaskResult websocket_session::doTask(Task&& input, uint32_t frame) {
+    auto start = std::chrono::steady_clock::now();
+    runningTask = &input;
+    auto answer = processTask(input.request);
+    runningTask = nullptr;
+
+    TaskResult result{
+        std::move(answer),
+        std::move(input.request.watch),
+        std::move(input.request.id),
+        frame,
+        std::chrono::duration_cast<std::chrono::microseconds>(start - input.queued),
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start),
+        input.text
+    };
+    result.cancel = std::move(input.cancel);
+    if (result.answer.deferred) {
+        // The async script can still be stopped
+        if (result.cancel)
+            result.cancel->status.store(TaskCancel::continuing, std::memory_order_release);
+        return result;
     }
-    return {};
+    if (input.request.noReply && !result.answer.failed()) {
+        // Nothing to build or send, the strand only needs to know the task is done
+        result.answer = TaskAnswer();
+        result.silent = true;
+    } else if (result.answer.remaining) {
+        startStream(result);
+    }
+    return result;
+}
+
+void websocket_session::startStream(TaskResult& result) {
+    auto stream = std::make_shared<ResultStream>();
+    stream->unsent = 1;
+    stream->id = nextStreamId++;
+    streams.push_back(streamingResult{
+        std::move(result.answer.remaining),
+        stream,
+        result.answer.type,
+        result.watch,
+        result.id,
+        result.answer.fields,
+        1,
+        result.text,
+        result.pushed,
+        result.cancel
+    });
+    result.stream = std::move(stream);
+    result.chunk = 0;
+    // The rest of the stream can still be cancelled
+    if (result.cancel)
+        result.cancel->status.store(TaskCancel::continuing, std::memory_order_release);
 }
 
-void websocket_session::processTasks() {
-    taskMutex.lock(); 
-    for (auto& it : todoTasks) {
-        completedTasks.emplace_back(doTask(it));
+void websocket_session::continueStreams(FrameBudget& budget) {
+    auto it = streams.begin();
+    while (it != streams.end() && !pendingResult && !budget.exhausted()) {
+        if (it->cancel && it->cancel->isCancelled()) {
+            // No final chunk, the client asked for nothing more. The task still has to be counted as done
+            TaskResult result;
+            result.silent = true;
+            result.cancel = it->cancel;
+            completeResult(std::move(result));
+            it = streams.erase(it);
+            continue;
+        }
+
+        // Memory stays bounded by not capturing more than the client reads
+        if (it->stream->unsent.load(std::memory_order_acquire) >= config.streamMaxUnsentChunks) {
+            ++it;
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        TaskResult result;
+        result.answer.type = it->type;
+        result.answer.res.emplace();
+        result.answer.fields = it->fields;
+        bool finished = it->capture->capture(*result.answer.res, config.streamChunkValues);
+        // A chunk is game thread work like any task, without this the deadline is never checked
+        ++budget.tasksRun;
+        // Cancelled while capturing, the check above drops the stream
+        if (finished && it->cancel && !it->cancel->finish())
+            continue;
+        result.watch = it->watch;
+        result.id = it->id;
+        result.frame = budget.frame;
+        result.queueTime = std::chrono::microseconds(0);
+        result.gameTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        result.text = it->text;
+        result.stream = it->stream;
+        result.chunk = it->nextChunk++;
+        result.finalChunk = finished;
+        result.pushed = it->pushed;
+
+        it->stream->unsent.fetch_add(1, std::memory_order_relaxed);
+        completeResult(std::move(result));
+
+        // Releases the game values, still on the game thread
+        it = finished ? streams.erase(it) : std::next(it);
     }
-    bool tasksCompleted = !todoTasks.empty();
-    todoTasks.clear();
-    taskMutex.unlock();
-    if (tasksCompleted) {
-        return boost::asio::post(
-            boost::asio::bind_executor(
-                strand_,
-                std::bind(
-                    &websocket_session::finishTasks,
-                    shared_from_this())));
+}
+
+void websocket_session::runSubscriptions(FrameBudget& budget) {
+    const auto count = subscriptions.size();
+    for (size_t i = 0; i < count; ++i) {
+        // The ones skipped when the budget ran out go first next frame
+        auto index = (nextSubscription + i) % count;
+        if (pendingResult || budget.exhausted() || !hasTokens()) {
+            nextSubscription = index;
+            return;
+        }
+        auto& it = subscriptions[index];
+        // Frame numbers may wrap around, the distance still has the right sign
+        if (static_cast<int32_t>(budget.frame - it.nextFrame) < 0)
+            continue;
+        // The previous update is still streaming, the next one is evaluated once it is done
+        if (std::any_of(streams.begin(), streams.end(), [&it](const streamingResult& stream) { return stream.subscription == it.handle; }))
+            continue;
+        it.nextFrame = budget.frame + it.request.interval;
+
+        auto start = std::chrono::steady_clock::now();
+        game_value res;
+        if (it.request.pure) {
+            // Everyone watching the same expression shares one evaluation per frame
+            auto key = frameResultKey(it.request);
+            if (auto cached = findFrameResult(key))
+                res = cached->value;
+            else
+                res = storeFrameResult(std::move(key), intercept::sqf::call(it.script)).value;
+        } else {
+            res = intercept::sqf::call(it.script);
+        }
+        ++budget.tasksRun;
+        tokens -= 1;
+
+        // Unchanged values cost neither capturing nor sending
+        auto hash = res.hash();
+        if (it.lastHash == hash)
+            continue;
+        it.lastHash = hash;
+
+        TaskResult result{
+            execResult(res, it.request),
+            it.request.watch,
+            it.request.id,
+            budget.frame,
+            std::chrono::microseconds(0),
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start),
+            true
+        };
+        // Tells the client which subscription an update belongs to, also without a watch target
+        result.answer.fields[resultField::handle] = it.handle;
+        result.pushed = true;
+        if (result.answer.remaining) {
+            startStream(result);
+            streams.back().subscription = it.handle;
+        }
+        completeResult(std::move(result));
     }
 }
 
-void websocket_session::on_read(boost::system::error_code ec, std::size_t bytes_transferred) {
-    boost::ignore_unused(bytes_transferred);
+bool websocket_session::hasQueuedTasks() const {
+    return std::any_of(todoTasks.begin(), todoTasks.end(), [](const MPSCQueue<Task>& lane) {
+        return !lane.empty();
+    });
+}
 
-    // Happens when the timer closes the socket
-    if (ec == boost::asio::error::operation_aborted)
+void websocket_session::refillTokens(std::chrono::steady_clock::time_point now) {
+    if (config.rateLimit <= 0)
         return;
+    auto elapsed = std::chrono::duration<double>(now - tokensUpdated).count();
+    tokens = std::min(config.rateBurst, tokens + elapsed * config.rateLimit);
+    tokensUpdated = now;
+}
 
-    // This indicates that the websocket_session was closed
-    if (ec == websocket::error::closed) {
-        wsSessions.erase(shared_from_this());
-        return;
+bool websocket_session::hasTokens() const {
+    return config.rateLimit <= 0 || tokens >= 1;
+}
+
+void websocket_session::chargeTokens(size_t count) {
+    // May go below zero, the session then waits until the bucket refilled
+    tokens -= static_cast<double>(count);
+}
+
+bool websocket_session::runTask(TaskLane lane, FrameBudget& budget) {
+    Task task;
+    if (!todoTasks[lane].try_pop(task))
+        return false;
+
+    // Withdrawn or too late, no game thread time is spent on it
+    if (task.cancel && !task.cancel->start()) {
+        TaskResult result;
+        result.silent = true;
+        result.cancel = std::move(task.cancel);
+        completeResult(std::move(result));
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (task.deadline && now > *task.deadline) {
+        TaskResult result;
+        result.answer.type = resultType::Expired;
+        // No watch, it must not replace a valid result for that watch target that wasn't sent yet
+        result.id = std::move(task.request.id);
+        result.frame = budget.frame;
+        result.queueTime = std::chrono::duration_cast<std::chrono::microseconds>(now - task.queued);
+        result.gameTime = std::chrono::microseconds(0);
+        result.text = task.text;
+        result.cancel = std::move(task.cancel);
+        completeResult(std::move(result));
+        return true;
     }
-        
 
-    if (ec)
-        fail(ec, "read");
+    auto result = doTask(std::move(task), budget.frame);
+    ++budget.tasksRun;
+    tokens -= 1;
+    // Answered by pollAsyncScripts later
+    if (!result.answer.deferred)
+        completeResult(std::move(result));
+    return true;
+}
+
+void websocket_session::completeResult(TaskResult&& result) {
+    resultsCompleted = true;
 
-    if (!bytes_transferred)
+    // We never wait for the IO thread here, the session is skipped until finishTasks made room
+    if (!completedTasks.try_push(std::move(result)))
+        pendingResult = std::move(result);
+}
+
+void websocket_session::retryPendingResult() {
+    if (pendingResult && completedTasks.try_push(std::move(*pendingResult)))
+        pendingResult.reset();
+}
+
+void websocket_session::flushResults() {
+    if (!resultsCompleted)
         return;
+    resultsCompleted = false;
+
+    boost::asio::post(
+        boost::asio::bind_executor(
+            strand_,
+            std::bind(
+                &websocket_session::finishTasks,
+                shared_from_this())));
+}
+
+void websocket_session::queueTask(Task&& task) {
+    auto lane = task.request.lane;
+    auto& overflow = overflowTasks[lane];
+    // Keep the order, once something overflowed everything after it has to wait too
+    if (!overflow.empty() || !todoTasks[lane].try_push(std::move(task)))
+        overflow.emplace_back(std::move(task));
+}
+
+void websocket_session::queueOverflowTasks() {
+    bool queuedAny = false;
+    for (size_t lane = 0; lane < laneCount; ++lane) {
+        auto& overflow = overflowTasks[lane];
+        auto it = overflow.begin();
+        while (it != overflow.end() && todoTasks[lane].try_push(std::move(*it)))
+            ++it;
+        queuedAny |= it != overflow.begin();
+        overflow.erase(overflow.begin(), it);
+    }
+    if (queuedAny)
+        TaskScheduler::markReady(*this);
+}
+
+void websocket_session::on_read(boost::system::error_code ec, std::size_t bytes_transferred) {
+    boost::ignore_unused(bytes_transferred);
+    read_pending_ = false;
+
+    if (ec) {
+        // The session is dead, no matter why
+        closed_ = true;
+        // The game thread still has to release what the session holds there
+        TaskScheduler::markReady(*this);
+
+        // Happens when the timer closes the socket
+        if (ec == boost::asio::error::operation_aborted)
+            return;
+
+        // This indicates that the websocket_session was closed
+        if (ec == websocket::error::closed)
+            return;
+
+        return fail(ec, "read");
+    }
 
     // Note that there is activity
     activity();
 
-    // Echo the message
+    // An empty message has no tasks, just wait for the next one
+    if (!bytes_transferred) {
+        resume_read();
+        return;
+    }
 
-    std::string message(buffers_to_string(buffer_.data()));
+    // Decode straight out of the receive buffer
+    auto data = buffer_.data();
+    decodeTasks(static_cast<const char*>(data.data()), data.size(), decoded_);
 
     buffer_.consume(buffer_.size()); //clear buffer
 
+    auto now = std::chrono::steady_clock::now();
+    for (auto& it : decoded_) {
+        if (it.type == TaskType::Cancel) {
+            cancel_task(it);
+            continue;
+        }
+
+        Task task{ std::move(it), ws_.got_text(), now };
+        if (task.request.deadline)
+            task.deadline = now + *task.request.deadline;
+        track_cancel(task);
+        queueTask(std::move(task));
+        ++in_flight_;
+    }
+    decoded_.clear();
+
+    // Cancel answers
+    do_write();
 
-    auto task = json::parse(message, nullptr, false);
+    TaskScheduler::markReady(*this);
 
+    // Keep reading while the tasks run, the results are sent whenever they are done
+    resume_read();
+}
 
-    taskMutex.lock();
+void websocket_session::track_cancel(Task& task) {
+    auto& request = task.request;
+    // For Subscribe and Unsubscribe the watch names the subscription, it isn't a value that gets stale
+    std::string key;
+    if (request.supersede)
+        key = *request.supersede;
+    else if (request.watch && request.type != TaskType::Subscribe && request.type != TaskType::Unsubscribe)
+        key = *request.watch;
+    if (key.empty() && request.id.is_null())
+        return;
 
-    if (task.is_array()) {
-        for (auto& it : task) {
-            todoTasks.emplace_back(Task{it, ws_.got_text()});
+    task.cancel = std::make_shared<TaskCancel>();
+    if (!request.id.is_null()) {
+        task.cancel->idKey = request.id.dump();
+        cancel_by_id_[task.cancel->idKey] = task.cancel;
+    }
+    if (!key.empty()) {
+        auto& slot = cancel_by_key_[key];
+        auto older = std::move(slot);
+        slot = task.cancel;
+        task.cancel->supersedeKey = std::move(key);
+
+        // Whatever the older task would produce is stale now. If it is running already its result still comes
+        if (older && older->cancel()) {
+            forget_cancel(*older);
+            // A client waiting for its id must not wait forever
+            if (!older->idKey.empty())
+                send_cancelled(older->idKey, nullptr, json(), true);
         }
-    } else {
-        todoTasks.emplace_back(Task{task, ws_.got_text()});
     }
-    taskMutex.unlock();
+}
 
+void websocket_session::forget_cancel(const TaskCancel& cancel) {
+    auto forget = [&cancel](std::unordered_map<std::string, std::shared_ptr<TaskCancel>>& map, const std::string& key) {
+        if (key.empty())
+            return;
+        auto found = map.find(key);
+        if (found != map.end() && found->second.get() == &cancel)
+            map.erase(found);
+    };
+    forget(cancel_by_id_, cancel.idKey);
+    forget(cancel_by_key_, cancel.supersedeKey);
+}
+
+void websocket_session::cancel_task(const TaskRequest& request) {
+    auto targetKey = request.target.dump();
+    auto found = cancel_by_id_.find(targetKey);
+    const char* error = "unknown id";
+    if (found != cancel_by_id_.end()) {
+        // Keeps the task alive while forget_cancel drops the map entries
+        auto cancel = found->second;
+        if (cancel->cancel()) {
+            forget_cancel(*cancel);
+            error = nullptr;
+        } else {
+            // The game thread is in it, its result comes as usual
+            error = "already running";
+        }
+    }
+    send_cancelled(targetKey, error, request.id, false);
+}
+
+void websocket_session::send_cancelled(const std::string& target, const char* error, const json& id, bool superseded) {
+    auto payload = std::make_shared<std::string>();
+    JsonWriter writer(*payload);
+    writer.startObject();
+    writer.key(resultField::type);
+    writer.value(resultType::Cancelled);
+    writer.key(resultField::target);
+    writer.raw(target);
+    if (error) {
+        writer.key(resultField::error);
+        writer.value(error);
+    }
+    if (superseded) {
+        // The answer to the superseded task itself, so it carries that task's id
+        writer.key(resultField::superseded);
+        writer.value(true);
+        writer.key(resultField::id);
+        writer.raw(target);
+    } else if (!id.is_null()) {
+        writer.key(resultField::id);
+        writer.value(id);
+    }
+    writer.endObject();
+    queue_outbound(std::move(payload));
+}
+
+void websocket_session::resume_read() {
+    if (read_pending_ || closed_ || in_flight_ >= config.maxInFlight)
+        return;
+    do_read();
+}
+
+// Builds and serializes the answer message, runs on the IO thread
+static void writeResult(std::string& out, const TaskResult& result) {
+    auto& answer = result.answer;
+    if (!answer.type) {
+        out += "null";
+        return;
+    }
+
+    JsonWriter writer(out);
+    writer.startObject();
+    writer.key(resultField::type);
+    writer.value(answer.type);
+    if (result.stream) {
+        // The next piece of the json text of res. The client joins the data of all chunks
+        // and parses it once the final one arrived
+        auto& stream = *result.stream;
+        stream.data.clear();
+        writeValueTape(stream.writer, *answer.res);
+        writer.key(resultField::stream);
+        writer.value(static_cast<int64_t>(stream.id));
+        writer.key(resultField::chunk);
+        writer.value(static_cast<int64_t>(result.chunk));
+        writer.key(resultField::data);
+        writer.value(stream.data);
+        if (result.finalChunk) {
+            writer.key(resultField::final);
+            writer.value(true);
+        }
+        if (answer.res->truncated) {
+            writer.key(resultField::truncated);
+            writer.value(true);
+        }
+    } else if (answer.res) {
+        writer.key(answer.resField);
+        writeValueTape(writer, *answer.res);
+        if (answer.res->truncated) {
+            writer.key(resultField::truncated);
+            writer.value(true);
+        }
+    }
+    for (auto it = answer.fields.begin(); it != answer.fields.end(); ++it) {
+        writer.key(it.key());
+        writer.value(it.value());
+    }
+    if (result.watch) {
+        writer.key(resultField::watch);
+        writer.value(*result.watch);
+    }
+    // Results arrive in any order, the client matches them by its own id
+    if (!result.id.is_null()) {
+        writer.key(resultField::id);
+        writer.value(result.id);
+    }
+    writer.key(resultField::frame);
+    writer.value(static_cast<int64_t>(result.frame));
+    writer.key(resultField::queueUs);
+    writer.value(static_cast<int64_t>(result.queueTime.count()));
+    writer.key(resultField::gameUs);
+    writer.value(static_cast<int64_t>(result.gameTime.count()));
+    writer.endObject();
 }
 
 void websocket_session::finishTasks() {
-    json result;
-    taskMutex.lock();
-    for (auto& it : completedTasks) {
-        result.emplace_back(it.message);
-    }
-    completedTasks.clear();
-    taskMutex.unlock();
-    std::string msg = result.dump();
-    buffer_.consume(buffer_.size()); //clear buffer
-    auto n = buffer_copy(buffer_.prepare(msg.size()), boost::asio::buffer(msg));
-    buffer_.commit(n);
+    // The game thread made room, move over what didn't fit before
+    queueOverflowTasks();
+
+    TaskResult task;
+    bool anyCompleted = false;
+    while (completedTasks.try_pop(task)) {
+        anyCompleted = true;
+        if (task.silent) {
+            --in_flight_;
+            if (task.cancel)
+                forget_cancel(*task.cancel);
+            continue;
+        }
+
+        // Serialized right into the buffer that is handed to the socket
+        auto payload = std::make_shared<std::string>();
+        writeResult(*payload, task);
+        // A task is in flight until its last chunk
+        if (!task.pushed && (!task.stream || task.finalChunk)) {
+            --in_flight_;
+            if (task.cancel)
+                forget_cancel(*task.cancel);
+        }
+        if (task.stream) {
+            queue_outbound(std::move(payload), {}, std::move(task.stream));
+        } else {
+            // Only plain values may be replaced by a newer one. Acks, errors and answers the client
+            // waits for by id are always delivered
+            bool plainValue = !task.answer.failed() && (task.pushed || (task.id.is_null() && std::string_view(task.answer.type) == resultType::ExecRet));
+            queue_outbound(std::move(payload), plainValue ? task.watch.value_or(std::string()) : std::string());
+        }
+    }
+    if (!anyCompleted)
+        return;
+
+    // Below the in flight limit again
+    resume_read();
+
+    do_write();
+}
+
+void websocket_session::queue_outbound(shared_payload payload, std::string watch, std::shared_ptr<ResultStream> stream) {
+    // Latest wins, nobody needs the old value of a watch that wasn't even sent yet
+    auto found = watch.empty() ? outbound_watches_.end() : outbound_watches_.find(watch);
+    if (found != outbound_watches_.end()) {
+        // The new value can be much bigger than the old one, so the limits still apply
+        outbound_bytes_ += payload->size();
+        outbound_bytes_ -= found->second->payload->size();
+        found->second->payload = std::move(payload);
+    } else {
+        outbound_bytes_ += payload->size();
+        outbound_.emplace_back(outbound_message{ std::move(payload), std::move(watch), std::move(stream) });
+        if (!outbound_.back().watch.empty())
+            outbound_watches_.emplace(outbound_.back().watch, &outbound_.back());
+    }
+
+    enforce_outbound_limits();
+}
+
+void websocket_session::pop_outbound() {
+    auto& front = outbound_.front();
+    if (!front.watch.empty())
+        outbound_watches_.erase(front.watch);
+    outbound_bytes_ -= front.payload->size();
+    outbound_.pop_front();
+}
+
+void websocket_session::enforce_outbound_limits() {
+    auto overLimit = [this]() {
+        return outbound_.size() > config.maxOutboundMessages || outbound_bytes_ > config.maxOutboundBytes;
+    };
+
+    if (!overLimit()) {
+        // Only forgive once the client caught up
+        if (outbound_bytes_ <= config.maxOutboundBytes / 2)
+            over_limit_since_.reset();
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (!over_limit_since_)
+        over_limit_since_ = now;
+
+    if (config.outboundPolicy == Config::outbound_policy::disconnect || now - *over_limit_since_ > config.slowClientTimeout) {
+        std::cerr << "websocket: client does not keep up with reading, disconnecting\n";
+        return drop_connection();
+    }
 
+    // Chunks of a streamed result are kept, the rest of the stream would be useless without them.
+    // streamMaxUnsentChunks bounds them instead
+    auto drop = [this](std::deque<outbound_message>::iterator it) {
+        outbound_bytes_ -= it->payload->size();
+        return outbound_.erase(it);
+    };
+    if (config.outboundPolicy == Config::outbound_policy::drop_oldest) {
+        // The newest message is always kept
+        auto it = outbound_.begin();
+        while (overLimit() && it != outbound_.end() && std::next(it) != outbound_.end())
+            it = it->stream ? std::next(it) : drop(it);
+    } else {
+        // drop_newest
+        auto it = outbound_.end();
+        while (overLimit() && it != outbound_.begin()) {
+            --it;
+            if (!it->stream)
+                it = drop(it);
+        }
+    }
+
+    // Erasing in the middle moved the messages
+    outbound_watches_.clear();
+    for (auto& it : outbound_) {
+        if (!it.watch.empty())
+            outbound_watches_.emplace(it.watch, &it);
+    }
+}
+
+void websocket_session::drop_connection() {
+    outbound_.clear();
+    outbound_watches_.clear();
+    outbound_bytes_ = 0;
+
+    // Closing the socket cancels all outstanding operations. They
+    // will complete with boost::asio::error::operation_aborted
+    boost::system::error_code ec;
+    ws_.next_layer().shutdown(tcp::socket::shutdown_both, ec);
+    ws_.next_layer().close(ec);
+}
+
+void websocket_session::do_write() {
+    // on_write will come back here
+    if (write_pending_ || outbound_.empty())
+        return;
+
+    // Everything that is queued goes out as one json array message, the payloads are
+    // referenced directly, only the brackets and commas are added around them
+    static const char arrayStart = '[';
+    static const char arraySeparator = ',';
+    static const char arrayEnd = ']';
+
+    write_buffers_.clear();
+    write_buffers_.emplace_back(&arrayStart, 1);
+    size_t bytes = 0;
+    while (!outbound_.empty() && (writing_.empty() || (writing_.size() < maxMessagesPerWrite && bytes < maxBytesPerWrite))) {
+        if (!writing_.empty())
+            write_buffers_.emplace_back(&arraySeparator, 1);
+        auto& payload = outbound_.front().payload;
+        write_buffers_.emplace_back(payload->data(), payload->size());
+        bytes += payload->size();
+        writing_.emplace_back(payload);
+        if (outbound_.front().stream)
+            writing_streams_.emplace_back(std::move(outbound_.front().stream));
+        pop_outbound();
+    }
+    write_buffers_.emplace_back(&arrayEnd, 1);
+
+    write_pending_ = true;
     ws_.async_write(
-        buffer_.data(),
-        std::bind(
-            &websocket_session::on_write,
-            shared_from_this(),
-            std::placeholders::_1,
-            std::placeholders::_2));
+        write_buffers_,
+        boost::asio::bind_executor(
+            strand_,
+            std::bind(
+                &websocket_session::on_write,
+                shared_from_this(),
+                std::placeholders::_1,
+                std::placeholders::_2)));
 }
 
 void websocket_session::on_write(boost::system::error_code ec, std::size_t bytes_transferred) {
     boost::ignore_unused(bytes_transferred);
+    write_pending_ = false;
+
+    // The payloads are not referenced by the socket anymore
+    writing_.clear();
+    // Lets the game thread capture the next chunks
+    for (auto& it : writing_streams_)
+        it->unsent.fetch_sub(1, std::memory_order_release);
+    writing_streams_.clear();
 
     // Happens when the timer closes the socket
     if (ec == boost::asio::error::operation_aborted)
@@ -456,11 +1207,8 @@ void websocket_session::on_write(boost::system::error_code ec, std::size_t bytes
     if (ec)
         return fail(ec, "write");
 
-    // Clear the buffer
-    buffer_.consume(buffer_.size());
-
-    // Do another read
-    do_read();
+    // Send what was queued while we were writing
+    do_write();
 }
 
 http_session::http_session(tcp::socket socket, std::string doc_root): socket_(std::move(socket))
@@ -554,7 +1302,6 @@ void http_session::on_read(boost::system::error_code ec) {
         ws = std::make_shared<websocket_session>(
             std::move(socket_));
         ws->do_accept(std::move(req_));
-        wsSessions.emplace(ws);
         return;
     }
 
@@ -669,12 +1416,20 @@ void listener::cleanupClosed() {
     }), sessions.end());
 }
 
-Server::Server() {
-    auto const address = net::ip::make_address("0.0.0.0");
-    auto const port = static_cast<unsigned short>(8082);
+// The config decides how many threads the io_context is created for, so it is loaded before that
+static int loadConfig() {
+    config.load(std::filesystem::path(thisDllDirPath()).parent_path() / "ArmaWebControl.json");
+    return static_cast<int>(config.ioThreadCount());
+}
+
+Server::Server() : ioc(loadConfig()) {
+    registerTaskHandlers();
 
     std::filesystem::path dllPath(thisDllDirPath());
 
+    auto const address = net::ip::make_address(config.address);
+    auto const port = config.port;
+
     std::string docroot((dllPath.parent_path() / "wdata").string());
 
     // Create and launch a listening port
@@ -685,8 +1440,14 @@ Server::Server() {
             docroot);
     httpServ->run();
 
-    // Run the I/O service on the requested number of threads
-    iothreads.emplace_back( [this] {
-            ioc.run();
-        });
+    // Run the I/O service on the requested number of threads.
+    // Handlers of one session are serialized by its strand, so they never run concurrently
+    auto threadCount = config.ioThreadCount();
+    iothreads.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; ++i) {
+        iothreads.emplace_back( [this] {
+                setupIoThread();
+                ioc.run();
+            });
+    }
 }
@@ -17,6 +17,8 @@
 #include "json.hpp"
 #include <algorithm>
 #include <cstdlib>
+#include <deque>
+#include <unordered_map>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -25,6 +27,10 @@
 #include <vector>
 #include <intercept.hpp>
 #include <filesystem>
+#include <optional>
+#include "mpscQueue.hpp"
+#include "scheduler.hpp"
+#include "tasks.hpp"
 
 using json = nlohmann::json;
 using tcp = boost::asio::ip::tcp;               // from <boost/asio/ip/tcp.hpp>
@@ -34,10 +40,89 @@ namespace net = boost::asio;            // from <boost/asio.hpp>
 
 
 
+// Lets the strand withdraw a task (Cancel, or superseded by a newer one) before the game thread runs it,
+// or stop its stream or async script later. Only allocated for tasks that have an id or supersede key
+class TaskCancel {
+public:
+    enum state : uint8_t {
+        queued,     // Not picked up by the game thread yet
+        running,    // The game thread is in it, it can't be stopped
+        continuing, // Goes on in later frames, a stream or async script
+        cancelled
+    };
+    std::atomic<state> status{ queued };
+
+    // Strand side. False if it is running, or was cancelled already
+    bool cancel() {
+        auto expected = status.load(std::memory_order_acquire);
+        while (expected == queued || expected == continuing) {
+            if (status.compare_exchange_weak(expected, cancelled, std::memory_order_acq_rel))
+                return true;
+        }
+        return false;
+    }
+    // Game thread side. False if it was cancelled before it got to run
+    bool start() {
+        auto expected = queued;
+        return status.compare_exchange_strong(expected, running, std::memory_order_acq_rel);
+    }
+    // Game thread side, before the final result of a stream or async script. False if it was cancelled meanwhile
+    bool finish() {
+        auto expected = continuing;
+        return status.compare_exchange_strong(expected, running, std::memory_order_acq_rel);
+    }
+    bool isCancelled() const {
+        return status.load(std::memory_order_acquire) == cancelled;
+    }
+
+    // Map keys on the strand, to forget the task once it is done
+    std::string idKey;
+    std::string supersedeKey;
+};
+
 class Task {
 public:
-    json message;
+    TaskRequest request;
+    bool text;
+    // When on_read received it
+    std::chrono::steady_clock::time_point queued;
+    std::shared_ptr<TaskCancel> cancel;
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+};
+
+// A result that is too big for one message, sent as numbered chunks of its json text.
+// Shared by the game thread, which captures the chunks, and the strand, which serializes and writes them
+class ResultStream {
+public:
+    // Chunks captured but not written to the socket yet, capturing waits while there are too many
+    std::atomic<size_t> unsent{ 0 };
+    // Sent with every chunk, several streams can be under way for the same id or watch target
+    uint32_t id = 0;
+    // Only touched on the strand. The writer keeps the nesting from one chunk to the next
+    std::string data;
+    JsonWriter writer{ data };
+};
+
+class TaskResult {
+public:
+    TaskAnswer answer;
+    // Copied from the request
+    std::optional<std::string> watch;
+    json id;
+    uint32_t frame;
+    std::chrono::microseconds queueTime;
+    // Time the task took on the game thread
+    std::chrono::microseconds gameTime;
     bool text;
+    // Set for the chunks of a streamed result
+    std::shared_ptr<ResultStream> stream;
+    uint32_t chunk = 0;
+    bool finalChunk = false;
+    // A noReply task that succeeded, only counted as done on the strand
+    bool silent = false;
+    // Sent on the server's initiative (subscription update), not the answer to a task in flight
+    bool pushed = false;
+    std::shared_ptr<TaskCancel> cancel;
 };
 
 
@@ -51,17 +136,188 @@ void fail(boost::system::error_code ec, char const* what);
 //------------------------------------------------------------------------------
 
 // Echoes back all received WebSocket messages
-class websocket_session : public std::enable_shared_from_this<websocket_session> {
+class websocket_session : public std::enable_shared_from_this<websocket_session>, public IntrusiveMPSCNode {
     websocket::stream<tcp::socket> ws_;
     boost::asio::strand<
         boost::asio::io_context::executor_type> strand_;
     boost::asio::steady_timer timer_;
-    boost::beast::multi_buffer buffer_;
+    boost::beast::flat_buffer buffer_;
     char ping_state_ = 0;
+    bool read_pending_ = false;
+    bool write_pending_ = false;
+    // Tasks that were read but whose result wasn't sent yet. Only touched on the strand
+    size_t in_flight_ = 0;
+    // Reused by on_read for decoding
+    std::vector<TaskRequest> decoded_;
+    // Tasks that can still be withdrawn, by id (as json text) and by supersede key. Only touched on the strand
+    std::unordered_map<std::string, std::shared_ptr<TaskCancel>> cancel_by_id_;
+    std::unordered_map<std::string, std::shared_ptr<TaskCancel>> cancel_by_key_;
+
+    // Sets up withdrawing the task, and withdraws the one it supersedes
+    void track_cancel(Task& task);
+    // The task is done, it can't be withdrawn anymore
+    void forget_cancel(const TaskCancel& cancel);
+    // Answers a Cancel right on the strand, it has to overtake the queued task
+    void cancel_task(const TaskRequest& request);
+    // target is the json text of the cancelled task's id, error is nullptr if it was cancelled
+    void send_cancelled(const std::string& target, const char* error, const json& id, bool superseded);
+
+    // A serialized message, immutable and shared so it is never copied again after serialization
+    using shared_payload = std::shared_ptr<const std::string>;
+
+    // Limits how much is gathered into one websocket message
+    static constexpr size_t maxMessagesPerWrite = 64;
+    static constexpr size_t maxBytesPerWrite = 256 * 1024;
+
+    struct outbound_message {
+        shared_payload payload;
+        // Plain values for the same watch target replace each other while unsent, empty for anything else
+        std::string watch;
+        // Set for chunks of a streamed result, they are never dropped or replaced
+        std::shared_ptr<ResultStream> stream;
+    };
 
-    std::vector<Task> todoTasks;
-    std::vector<Task> completedTasks;
-    std::mutex taskMutex;
+    // Messages waiting to be written, only touched on the strand
+    std::deque<outbound_message> outbound_;
+    size_t outbound_bytes_ = 0;
+    // Unsent plain watch values, by watch target. Deque elements stay put when pushing/popping at the ends
+    std::unordered_map<std::string, outbound_message*> outbound_watches_;
+    // Since when the client has been over its outbound limits
+    std::optional<std::chrono::steady_clock::time_point> over_limit_since_;
+    // Messages of the write in progress, and the buffers referencing them
+    std::vector<shared_payload> writing_;
+    std::vector<boost::asio::const_buffer> write_buffers_;
+    // Streams with chunks in the write in progress, one entry per chunk
+    std::vector<std::shared_ptr<ResultStream>> writing_streams_;
+
+    void queue_outbound(shared_payload payload, std::string watch = {}, std::shared_ptr<ResultStream> stream = {});
+    void pop_outbound();
+    // Applies the configured policy if the client doesn't keep up with reading
+    void enforce_outbound_limits();
+    // Closes the connection without waiting for the client
+    void drop_connection();
+    // Starts writing everything that is queued, unless a write is already running
+    void do_write();
+
+    // Room for the tasks of a full in flight window. Anything beyond waits in overflowTasks or pendingResult,
+    // so a connection doesn't allocate cells it can never use
+    static size_t taskQueueCapacity();
+
+    // Filled on the strand in on_read, drained by the game thread. One queue per TaskLane
+    std::array<MPSCQueue<Task>, laneCount> todoTasks;
+    // Filled by the game thread, drained on the strand in finishTasks
+    MPSCQueue<TaskResult> completedTasks;
+    // Tasks that didn't fit into todoTasks yet, only touched on the strand
+    std::array<std::vector<Task>, laneCount> overflowTasks;
+    // Result that didn't fit into completedTasks yet, only touched by the game thread
+    std::optional<TaskResult> pendingResult;
+
+    // A result that is still being captured, one chunk per frame. Only touched by the game thread
+    struct streamingResult {
+        std::unique_ptr<GameValueCapture> capture;
+        std::shared_ptr<ResultStream> stream;
+        const char* type;
+        std::optional<std::string> watch;
+        json id;
+        // Extra fields of the answer, repeated in every chunk
+        json fields;
+        uint32_t nextChunk;
+        bool text;
+        bool pushed;
+        // Cancelling the task also stops its stream
+        std::shared_ptr<TaskCancel> cancel;
+        // Handle of the subscription that pushed it, 0 for task results
+        uint32_t subscription = 0;
+    };
+    std::vector<streamingResult> streams;
+    uint32_t nextStreamId = 1;
+
+    // Scripts compiled by Prepare, by handle. Only touched by the game thread
+    std::unordered_map<uint32_t, code> preparedScripts;
+    uint32_t nextPreparedHandle = 1;
+    // The mission the game state above belongs to, see TaskScheduler::missionEnded
+    uint32_t mission = 0;
+    // Expressions the game thread evaluates every interval frames, the client gets an update
+    // whenever the value changed. Only touched by the game thread
+    struct subscription {
+        uint32_t handle;
+        code script;
+        uint32_t nextFrame;
+        std::optional<size_t> lastHash;
+        // The Subscribe task, its watch, id and interval apply to every update
+        TaskRequest request;
+    };
+    std::vector<subscription> subscriptions;
+    uint32_t nextSubscriptionHandle = 1;
+    // Where runSubscriptions starts, the one the budget ran out at last time
+    size_t nextSubscription = 0;
+
+    // ExecAsync scripts that are still running, polled every frame. Only touched by the game thread
+    struct asyncScript {
+        script handle;
+        // missionNamespace variables the wrapper stores the result and the script its progress in
+        std::string resultVar;
+        std::string progressVar;
+        std::optional<size_t> lastProgressHash;
+        std::chrono::steady_clock::time_point started;
+        // When the ExecAsync task was received
+        std::chrono::steady_clock::time_point queued;
+        bool text;
+        TaskRequest request;
+        std::shared_ptr<TaskCancel> cancel;
+    };
+    std::vector<asyncScript> asyncScripts;
+    // The task that is being run, for handlers that keep it running past the frame
+    const Task* runningTask = nullptr;
+    // Sends progress and results of async scripts, and stops cancelled ones.
+    // Progress and results count against the budget, the ones it ran out at go first next frame
+    void pollAsyncScripts(FrameBudget& budget);
+    void stopAsyncScript(asyncScript& running);
+
+    // Drops the game values the session holds, called by the game thread once it is closed
+    void releaseGameState();
+    // Drops what belongs to a mission that has ended, its handles are unknown from then on
+    void forgetEndedMission(uint32_t currentMission);
+
+    friend class TaskScheduler;
+    // Set while the session is in the scheduler's ready list
+    std::atomic<bool> ready_{ false };
+    // Keeps the session alive while it is in the ready list
+    std::shared_ptr<websocket_session> readySelf;
+    // Set once the connection is gone, queued tasks are dropped then
+    std::atomic<bool> closed_{ false };
+
+    // Scheduler state, only touched by the game thread
+    bool scheduled = false;
+    bool resultsCompleted = false;
+    double weight;
+    std::array<int64_t, laneCount> deficit{}; // Nanoseconds of game thread time per lane
+    double tokens;
+    std::chrono::steady_clock::time_point tokensUpdated;
+
+    void queueTask(Task&& task);
+    void queueOverflowTasks();
+
+    bool hasQueuedTasks(TaskLane lane) const {
+        return !todoTasks[lane].empty();
+    }
+    bool hasQueuedTasks() const;
+    // Token bucket rate limit
+    void refillTokens(std::chrono::steady_clock::time_point now);
+    bool hasTokens() const;
+    // Runs the next task of that lane, returns false if there is none
+    bool runTask(TaskLane lane, FrameBudget& budget);
+    void retryPendingResult();
+    // Turns a result with remaining parts into the first chunk of a stream
+    void startStream(TaskResult& result);
+    // Captures the next chunk of every stream whose client keeps up
+    void continueStreams(FrameBudget& budget);
+    // Evaluates the subscriptions that are due this frame. Each costs a token like a task
+    void runSubscriptions(FrameBudget& budget);
+    // Hands a result to the strand, or keeps it as pendingResult if the queue is full
+    void completeResult(TaskResult&& result);
+    // Sends off the results of tasks that completed this frame
+    void flushResults();
 public:
     // Take ownership of the socket
     explicit websocket_session(tcp::socket socket);
@@ -87,14 +343,34 @@ public:
 
     void do_read();
 
-    json processTask(const json& task);
+    // Starts the next read unless one is running or too many tasks are in flight
+    void resume_read();
 
-    Task doTask(const Task& input) {
-        auto answer = processTask(input.message);
-        return Task{ answer, input.text };
-    }
+    TaskAnswer processTask(const TaskRequest& task);
+
+    // Game thread only. Keeps compiled code until it is released, the session closes or the mission ends.
+    // Returns 0 if the session has maxPreparedScripts already
+    uint32_t prepareScript(code compiled);
+    // nullptr if there is no such handle
+    const code* preparedScript(uint32_t handle) const;
+    bool releaseScript(uint32_t handle);
+
+    // Game thread only. A Subscribe for a watch target that already has one replaces it.
+    // Subscriptions end with the mission, their expressions may not make sense in the next one.
+    // Returns 0 if the session has maxSubscriptions already
+    uint32_t subscribe(const TaskRequest& task, code script);
+    // By handle, or by watch target if handle is 0
+    bool unsubscribe(uint32_t handle, const std::optional<std::string>& watch);
+
+    // Game thread only. For tasks that do the work of several, the task itself already cost one token
+    void chargeTokens(size_t count);
+
+    // Game thread only. Whether another async script may be started
+    bool canStartAsyncScript() const;
+    // Takes over a spawned script, the task is answered once it is done. Only from the handler of the running task
+    void trackAsyncScript(const TaskRequest& task, script handle, std::string resultVar, std::string progressVar);
 
-    void processTasks();
+    TaskResult doTask(Task&& input, uint32_t frame);
 
     void on_read(boost::system::error_code ec, std::size_t bytes_transferred);
 
@@ -230,7 +506,8 @@ class http_session : public std::enable_shared_from_this<http_session>
     http::request<http::string_body> req_;
     queue queue_;
     std::shared_ptr<websocket_session> ws;
-    bool closed;
+    // Read by the listener from another IO thread
+    std::atomic<bool> closed{ false };
 public:
     // Take ownership of the socket
     explicit http_session(
@@ -291,7 +568,7 @@ class Server {
 public:
     Server();
 
-    boost::asio::io_context ioc{ 1 };
+    boost::asio::io_context ioc;
     std::vector<std::thread> iothreads;
     std::shared_ptr<listener> httpServ;
 };
@@ -1,28 +1,41 @@
 var playerNames = [];
 var socket;
 var watchEnabled = false;
-var watchTimeoutID = null;
+// Watch targets the server evaluates for us
+var watchSubscribed = {};
+// Data of streamed results until their final chunk arrived, by stream id
+var resultStreams = {};
 
 function onMessage(data) {
     //message('<p class="message">Received: '+data);
     var obj = JSON.parse(data);
 
     function processMessage(msg){
-        if (msg.type == "playerlist") {
+        // Huge results arrive as numbered chunks of their json text
+        if ('chunk' in msg) {
+            // Several streams for the same id or watch target can be under way at once
+            var key = msg.stream;
+            var parts = msg.chunk == 0 ? [] : (resultStreams[key] || []);
+            parts.push(msg.data);
+            if (!msg.final) {
+                resultStreams[key] = parts;
+                return;
+            }
+            delete resultStreams[key];
+            msg.res = JSON.parse(parts.join(''));
+        }
+        if ('error' in msg) {
+            message('<p class="warning">' + msg.type + ' failed: ' + msg.error);
+        }
+        if (msg.type == Protocol.ResultType.playerlist) {
             playerNames = msg.players;
             updatePlayerlistCombo();
         }
-        if ('watch' in msg) {
-            $(msg.watch).html(hljs.highlight('sqf', msg.res).value);
+        if (msg.type == Protocol.ResultType.ExecRet && 'watch' in msg) {
+            // Results come as json values now, strings are shown as they are
+            var res = typeof msg.res === 'string' ? msg.res : JSON.stringify(msg.res);
+            $(msg.watch).html(hljs.highlight('sqf', res).value);
             $($(msg.watch).attr("in")).css('background', '#fff');
-
-            if (watchTimeoutID == null) {
-                watchTimeoutID =  setTimeout(function(){
-                    updateWatchFields();
-                    watchTimeoutID = null;
-                }, document.getElementById('watchTimeout').value * 1000);
-            }
-
         }
     }
 
@@ -58,7 +71,8 @@ function executeLocalScript() {
     var script = $('#execLocalScript').val();
 
     var msg = {
-        type: "Exec",
+        type: Protocol.TaskType.Exec,
+        noReply: true,
         script: script
     }
     socket.send(JSON.stringify(msg));
@@ -68,7 +82,8 @@ function executeGlobalScript() {
     var script = $('#execGlobalScript').val();
 
     var msg = {
-        type: "ExecFunc",
+        type: Protocol.TaskType.ExecFunc,
+        noReply: true,
         fnc: "CBA_fnc_globalExecute",
         args: [
             -1,
@@ -82,7 +97,8 @@ function executeGlobalScript() {
 
 function executeUnitScript() {
     var msg = {
-        type: "ExecFunc",
+        type: Protocol.TaskType.ExecFunc,
+        noReply: true,
         fnc: "ArmaWebControl_main_fnc_execOnPlayername",
         args: [
             $('#unitlist').val(),
@@ -96,7 +112,8 @@ function executeUnitScript() {
 
 function executeFromUnitScript() {
     var msg = {
-        type: "ExecFunc",
+        type: Protocol.TaskType.ExecFunc,
+        noReply: true,
         fnc: "ArmaWebControl_main_fnc_execFromUnit",
         args: [
             $('#unitlist2').val(),
@@ -110,7 +127,7 @@ function executeFromUnitScript() {
 
 function refreshPlayerList() {
     var msg = {
-        type: "getPlayerlist"
+        type: Protocol.TaskType.getPlayerlist
     }
     socket.send(JSON.stringify(msg));
 }
@@ -139,34 +156,44 @@ function loadPreset(combo, textbox, presetList, highlightBox){
     $(highlightBox).html(hljs.highlight('sqf', code).value);
 }
 
+// The server evaluates the watch expressions itself and only sends values that changed
 function updateWatchFields() {
+    if (!socket || socket.readyState != WebSocket.OPEN) {
+        return;
+    }
+
+    var isEnabled = document.getElementById('doUpdateWatch').checked;
+    var interval = Math.max(1, parseInt(document.getElementById('watchInterval').value) || 1);
     var tasks = [];
     document.querySelectorAll('#Watch textarea').forEach((block) => {
-        if ($(block).val() != ""){
-            var msg = {
-                type: "Exec",
-                watch: $(block).attr("out"),
-                script: $(block).val()
-            }
-            tasks.push(msg);
+        var watch = $(block).attr("out");
+        if (isEnabled && $(block).val() != "") {
+            // Subscribing the same target again replaces the old expression.
+            // Watches only read state, other viewers of the same expression share its evaluation
+            tasks.push({
+                type: Protocol.TaskType.Subscribe,
+                watch: watch,
+                script: $(block).val(),
+                interval: interval,
+                pure: true
+            });
+            watchSubscribed[watch] = true;
             $(block).css('background', '#ccc');
+        } else if (watchSubscribed[watch]) {
+            tasks.push({
+                type: Protocol.TaskType.Unsubscribe,
+                watch: watch
+            });
+            delete watchSubscribed[watch];
         }
     });
-    socket.send(JSON.stringify(tasks));
+    if (tasks.length > 0) {
+        socket.send(JSON.stringify(tasks));
+    }
 }
 
 function updateWatchEnabled() {
-    var isEnabled = document.getElementById('doUpdateWatch').checked;
-
-    if (!isEnabled && watchTimeoutID != null) {
-        clearTimeout(watchTimeoutID);
-        watchTimeoutID = null;
-    } else if (isEnabled && watchTimeoutID == null) {
-        watchTimeoutID =  setTimeout(function(){
-            updateWatchFields();
-            watchTimeoutID = null;
-        }, document.getElementById('watchTimeout').value * 1000);
-    }
+    updateWatchFields();
 }
 
 
@@ -191,6 +218,9 @@ $(document).ready(function() {
 
                 socket.onopen = function(){
                     message('<p class="event">Socket Status: '+socket.readyState+' (open)');
+                    // Subscriptions belong to the connection
+                    watchSubscribed = {};
+                    updateWatchFields();
                 }
 
                 socket.onmessage = (msg) => onMessage(msg.data);